@@ -0,0 +1,355 @@
+#include <sys/stat.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define DAYSPERWEEK   7
+#define EPOCHWDAY     THURSDAY          /* weekday of 1970-01-01 */
+#define ISLEAP(y)     ((!((y) % 4) && ((y) % 100)) || !((y) % 400))
+#define FIRSTDAY      (-719162)         /* 0001-01-01, in unix julian day */
+#define LASTDAY       2932896           /* 9999-12-31, in unix julian day */
+#define MAXROUNDS     100               /* maximum number of rounds of each function */
+#define DATESIZE      32                /* maximum size of a date string */
+
+/* table of day in month, indexed by whether year is leap and month number */
+static const int daytab[2][13] = {
+	{0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
+	{0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
+};
+
+static int nrounds = 5;                 /* number of rounds of each function */
+static volatile int sink;               /* keeps the results from being optimized away */
+
+/* show usage and exit */
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "usage: date [-n rounds]\n");
+	exit(1);
+}
+
+/* convert string value to int between min and max; exit on error */
+static int
+getint(const char *s, int min, int max)
+{
+	char *end;
+	long n;
+
+	n = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || n < min || n > max)
+		errx(1, "%s: invalid number", s);
+	return n;
+}
+
+/* get the time, in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* set the weeks of the month of date, as util.c did before its tables */
+static void
+refsetmonthweek(struct Date *d)
+{
+	d->pmw = 1 + (d->d - 1) / DAYSPERWEEK;
+	d->nmw = -1 - (daytab[ISLEAP(d->y)][d->m] - d->d) / DAYSPERWEEK;
+}
+
+/* convert struct Date to unix julian day, as util.c did before its tables */
+static int
+refdatetojulian(struct Date *d)
+{
+	int y, m;
+
+	if (d->y < 1 || d->m < 1 || d->m > 12 || d->d < 1 || d->d > daytab[ISLEAP(d->y)][d->m])
+		return -1;
+	y = d->y;
+	m = d->m;
+	if (m < 3) {
+		y--;
+		m += 12;
+	}
+	return (y * 365) + (y / 4) - (y / 100) + (y / 400) - 719468 + (m * 153 + 3) / 5 - 92 + d->d - 1;
+}
+
+/* convert unix julian day to struct Date, as util.c did before its tables */
+static void
+refjuliantodate(struct Date *d, int j)
+{
+	int z, era, doe, yoe, doy, mp;
+
+	z = j + 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	d->d = doy - (153 * mp + 2) / 5 + 1;
+	d->m = mp < 10 ? mp + 3 : mp - 9;
+	d->y = yoe + era * 400 + (d->m <= 2);
+	d->w = ((j + EPOCHWDAY) % DAYSPERWEEK + DAYSPERWEEK) % DAYSPERWEEK;
+	refsetmonthweek(d);
+}
+
+/* increment date by one day, as util.c did before its tables */
+static void
+refincrdate(struct Date *d)
+{
+	if (d->y < 1 || d->m < 1 || d->m > 12 || d->d < 1 || d->d > daytab[ISLEAP(d->y)][d->m])
+		return;
+	d->w = (d->w + 1) % DAYSPERWEEK;
+	if (d->d < daytab[ISLEAP(d->y)][d->m]) {
+		d->d++;
+	} else if (d->m < 12) {
+		d->m++;
+		d->d = 1;
+	} else {
+		d->y++;
+		d->m = 1;
+		d->d = 1;
+	}
+	refsetmonthweek(d);
+}
+
+/* convert date string of length len in yyyy-mm-dd format to unix julian day, as todo.c did before strtojulian */
+static int
+refstrtojulian(int *j, const char *s, size_t len)
+{
+	struct tm tm;
+	struct Date d;
+	char date[DATESIZE];
+
+	len = len < sizeof(date) - 1 ? len : sizeof(date) - 1;
+	memcpy(date, s, len);
+	date[len] = '\0';
+	memset(&tm, 0, sizeof(tm));
+	if (strptime(date, "%Y-%m-%d", &tm) == NULL)
+		return -1;
+	d.y = tm.tm_year + 1900;
+	d.m = tm.tm_mon + 1;
+	d.d = tm.tm_mday;
+	*j = refdatetojulian(&d);
+	return 0;
+}
+
+/* get the yyyy-mm-dd strings of every day from 0001-01-01 to 9999-12-31, DATESIZE bytes apart */
+static char *
+getstrings(void)
+{
+	static char *strs = NULL;
+	struct Date d;
+	int j;
+
+	if (strs != NULL)
+		return strs;
+	strs = ecalloc(LASTDAY - FIRSTDAY + 1, DATESIZE);
+	for (j = FIRSTDAY; j <= LASTDAY; j++) {
+		juliantodate(&d, j);
+		snprintf(strs + (size_t)(j - FIRSTDAY) * DATESIZE, DATESIZE, "%04d-%02d-%02d", d.y, d.m, d.d);
+	}
+	return strs;
+}
+
+/* check whether two dates are the same in every field */
+static int
+samedate(struct Date *a, struct Date *b)
+{
+	return a->y == b->y && a->m == b->m && a->d == b->d && a->w == b->w &&
+	       a->pmw == b->pmw && a->nmw == b->nmw;
+}
+
+/* check the functions of util.c against the reference ones on every day from 0001-01-01 to 9999-12-31; return -1 if they differ */
+static int
+check(void)
+{
+	static const char *bad[] = {
+		"", "2021", "2021-05", "2021-05-", "0000-01-01", "2021-00-10", "2021-13-10",
+		"2021-02-29", "2021-04-31", "2021-05-08x", "12021-05-08", "2021-005-08",
+	};
+	struct Date d, ref, next;
+	const char *s;
+	int i, j, k;
+
+	for (j = FIRSTDAY; j <= LASTDAY; j++) {
+		juliantodate(&d, j);
+		refjuliantodate(&ref, j);
+		if (!samedate(&d, &ref) || datetojulian(&d) != j || refdatetojulian(&ref) != j) {
+			warnx("day %d: %04d-%02d-%02d, expected %04d-%02d-%02d", j, d.y, d.m, d.d, ref.y, ref.m, ref.d);
+			return -1;
+		}
+		next = d;
+		incrdate(&next);
+		refincrdate(&ref);
+		if (!samedate(&next, &ref)) {
+			warnx("day after %04d-%02d-%02d: %04d-%02d-%02d", d.y, d.m, d.d, next.y, next.m, next.d);
+			return -1;
+		}
+
+		/* every day must be read back from its string */
+		s = getstrings() + (size_t)(j - FIRSTDAY) * DATESIZE;
+		if (strtojulian(&k, s, strlen(s)) == -1 || k != j) {
+			warnx("%s: not read back as day %d", s, j);
+			return -1;
+		}
+	}
+
+	/* dates that are not in the calendar, or not in the format, must be rejected */
+	for (i = 0; i < (int)(sizeof(bad) / sizeof(*bad)); i++) {
+		if (strtojulian(&k, bad[i], strlen(bad[i])) != -1) {
+			warnx("%s: not rejected", bad[i]);
+			return -1;
+		}
+	}
+
+	/* days before year 1 are only converted from julian days */
+	for (j = FIRSTDAY - 146097; j < FIRSTDAY; j++) {
+		juliantodate(&d, j);
+		refjuliantodate(&ref, j);
+		if (!samedate(&d, &ref)) {
+			warnx("day %d: %d-%02d-%02d, expected %d-%02d-%02d", j, d.y, d.m, d.d, ref.y, ref.m, ref.d);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* time converting every day from 0001-01-01 to 9999-12-31 to a date; get nanoseconds per day */
+static double
+timejuliantodate(void (*fun)(struct Date *, int))
+{
+	struct Date d;
+	double start, secs, min;
+	int i, j, sum;
+
+	min = 0;
+	for (i = 0; i < nrounds; i++) {
+		sum = 0;
+		start = now();
+		for (j = FIRSTDAY; j <= LASTDAY; j++) {
+			(*fun)(&d, j);
+			sum += d.d + d.pmw;
+		}
+		secs = now() - start;
+		sink = sum;
+		if (i == 0 || secs < min)
+			min = secs;
+	}
+	return min * 1e9 / (LASTDAY - FIRSTDAY + 1);
+}
+
+/* time converting every day from 0001-01-01 to 9999-12-31 to a julian day; get nanoseconds per day */
+static double
+timedatetojulian(int (*fun)(struct Date *))
+{
+	static struct Date *days = NULL;
+	double start, secs, min;
+	int i, j, n, sum;
+
+	n = LASTDAY - FIRSTDAY + 1;
+	if (days == NULL) {
+		days = ecalloc(n, sizeof(*days));
+		for (j = 0; j < n; j++)
+			juliantodate(&days[j], FIRSTDAY + j);
+	}
+	min = 0;
+	for (i = 0; i < nrounds; i++) {
+		sum = 0;
+		start = now();
+		for (j = 0; j < n; j++)
+			sum += (*fun)(&days[j]);
+		secs = now() - start;
+		sink = sum;
+		if (i == 0 || secs < min)
+			min = secs;
+	}
+	return min * 1e9 / n;
+}
+
+/* time going through every day from 0001-01-01 to 9999-12-31 one day after another; get nanoseconds per day */
+static double
+timeincrdate(void (*fun)(struct Date *))
+{
+	struct Date d;
+	double start, secs, min;
+	int i, j, sum;
+
+	min = 0;
+	for (i = 0; i < nrounds; i++) {
+		sum = 0;
+		juliantodate(&d, FIRSTDAY);
+		start = now();
+		for (j = FIRSTDAY; j < LASTDAY; j++) {
+			(*fun)(&d);
+			sum += d.d + d.nmw;
+		}
+		secs = now() - start;
+		sink = sum;
+		if (i == 0 || secs < min)
+			min = secs;
+	}
+	return min * 1e9 / (LASTDAY - FIRSTDAY);
+}
+
+/* time reading the string of every day from 0001-01-01 to 9999-12-31; get nanoseconds per day */
+static double
+timestrtojulian(int (*fun)(int *, const char *, size_t))
+{
+	const char *strs;
+	double start, secs, min;
+	int i, j, n, k, sum;
+
+	n = LASTDAY - FIRSTDAY + 1;
+	strs = getstrings();
+	min = 0;
+	for (i = 0; i < nrounds; i++) {
+		sum = 0;
+		start = now();
+		for (j = 0; j < n; j++) {
+			(*fun)(&k, strs + (size_t)j * DATESIZE, 10);
+			sum += k;
+		}
+		secs = now() - start;
+		sink = sum;
+		if (i == 0 || secs < min)
+			min = secs;
+	}
+	return min * 1e9 / n;
+}
+
+/* date: check and time the date functions of util.c against the ones they replaced */
+int
+main(int argc, char *argv[])
+{
+	int ch, ok;
+
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nrounds = getint(optarg, 1, MAXROUNDS);
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	ok = (check() == 0);
+
+	/* tab-separated line: function, nanoseconds per day of util.c and of the reference, and check */
+	printf("function\tns_util\tns_ref\tcheck\n");
+	printf("juliantodate\t%.3f\t%.3f\t%s\n", timejuliantodate(juliantodate), timejuliantodate(refjuliantodate), ok ? "ok" : "FAIL");
+	printf("datetojulian\t%.3f\t%.3f\t%s\n", timedatetojulian(datetojulian), timedatetojulian(refdatetojulian), ok ? "ok" : "FAIL");
+	printf("incrdate\t%.3f\t%.3f\t%s\n", timeincrdate(incrdate), timeincrdate(refincrdate), ok ? "ok" : "FAIL");
+	printf("strtojulian\t%.3f\t%.3f\t%s\n", timestrtojulian(strtojulian), timestrtojulian(refstrtojulian), ok ? "ok" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+#include <err.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BASEYEAR      2021              /* year around which dates are generated */
+#define BASEDAY       738223            /* 2021-05-08, in days since 0000-03-01 */
+#define MIN(x,y)      ((x)<(y)?(x):(y))
+
+static const char *months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+	"January", "February", "March", "April", "May", "June",
+	"July", "August", "September", "October", "November", "December",
+};
+
+static const char *weekdays[] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+	"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday",
+};
+
+static const char *words[] = {
+	"review", "meeting", "with", "the", "team", "about", "release", "call",
+	"dentist", "birthday", "of", "deadline", "report", "send", "invoice",
+	"holiday", "standup", "lunch", "plan", "sprint", "backup", "server",
+};
+
+static uint64_t state = 88172645463325252ULL;
+
+/* show usage and exit */
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "usage: gen -c [-n events] [-s seed]\n"
+	                      "       gen -t [-d depth] [-i fanin] [-n tasks] [-o fanout] [-r spread] [-s seed]\n");
+	exit(1);
+}
+
+/* convert string value to int between min and max; exit on error */
+static int
+getint(const char *s, int min, int max)
+{
+	char *end;
+	long n;
+
+	n = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || n < min || n > max)
+		errx(1, "%s: invalid number", s);
+	return n;
+}
+
+/* get pseudo-random number from 0 to n - 1 (xorshift64*) */
+static unsigned long
+rnd(unsigned long n)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (state * 2685821657736338717ULL >> 32) % n;
+}
+
+/* print a few random words */
+static void
+printwords(int n)
+{
+	while (n-- > 0)
+		printf(" %s", words[rnd(sizeof(words) / sizeof(*words))]);
+}
+
+/* print date around the base year as yyyy-mm-dd, sep being the separator */
+static void
+printdate(int year, int month, int day, int sep)
+{
+	if (year > 0)
+		printf("%04d%c", year, sep);
+	printf("%02d%c%02d", month, sep, day);
+}
+
+/* print a random day pattern, in one of the formats calendar(1) accepts */
+static void
+printpattern(void)
+{
+	unsigned long r;
+
+	r = rnd(100);
+	if (r < 30) {                   /* day of every year */
+		printdate(0, 1 + rnd(12), 1 + rnd(28), '/');
+	} else if (r < 45) {            /* fixed date */
+		printdate(BASEYEAR - 2 + rnd(5), 1 + rnd(12), 1 + rnd(28), "/-."[rnd(3)]);
+	} else if (r < 60) {            /* weekday */
+		printf("%s", weekdays[rnd(14)]);
+	} else if (r < 75) {            /* weekday of a week of the month */
+		if (rnd(2))
+			printf("%02d/", 1 + (int)rnd(12));
+		printf("%s%+d", weekdays[rnd(7)], rnd(2) ? 1 + (int)rnd(4) : -1 - (int)rnd(2));
+	} else if (r < 90) {            /* named month */
+		if (rnd(4) == 0)
+			printf("%d/", BASEYEAR - 2 + (int)rnd(5));
+		printf("%s/%d", months[rnd(24)], 1 + (int)rnd(28));
+	} else {                        /* day of the month */
+		printf("%d", 1 + (int)rnd(31));
+	}
+}
+
+/* generate n calendar events */
+static void
+gencalendar(int n)
+{
+	int i, j, npatts;
+
+	for (i = 0; i < n; i++) {
+		switch (rnd(50)) {
+		case 0:
+			printf("# comment%d\n\n", i);
+			continue;
+		case 1:
+			printf("invalid line %d\n", i);
+			continue;
+		}
+		npatts = (rnd(20) == 0) ? 2 + rnd(3) : 1;
+		for (j = 0; j < npatts; j++) {
+			if (j > 0)
+				printf(", ");
+			printpattern();
+		}
+		printf("\tEvent %d", i);
+		printwords(1 + rnd(6));
+		printf("\n");
+	}
+}
+
+/*
+ * Generate n tasks in depth layers; each task not in the last layer
+ * depends on fanout tasks of the next layer.  Those are taken from
+ * the beginning of the next layer, so that the tasks depended on are
+ * depended on by about fanin tasks each.  Due dates are spread over
+ * spread days around the base date.
+ */
+static void
+gentodo(int n, int depth, int fanin, int fanout, int spread)
+{
+	long i, j, layer, first, next, size, window;
+	long jul, y, m, d, era, doe, yoe, doy, mp;
+
+	for (i = 0; i < n; i++) {
+		layer = i * depth / n;
+		printf("%s task%ld: ", rnd(10) == 0 ? "DONE" : "TODO", i);
+		switch (rnd(6)) {
+		case 0:
+			printf("(A) ");
+			break;
+		case 1:
+			printf("(C) ");
+			break;
+		case 2:
+			printf("(B) ");
+			break;
+		}
+		printf("Task %ld", i);
+		printwords(1 + rnd(5));
+		if (spread > 0 && rnd(3) != 0) {
+			/* a day around the base date, from days since 0000-03-01 to a civil date */
+			jul = BASEDAY + (long)rnd(2 * spread + 1) - spread;
+			era = jul / 146097;
+			doe = jul - era * 146097;
+			yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+			doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+			mp = (5 * doy + 2) / 153;
+			d = doy - (153 * mp + 2) / 5 + 1;
+			m = mp < 10 ? mp + 3 : mp - 9;
+			y = yoe + era * 400 + (m <= 2);
+			printf(" due:%04ld-%02ld-%02ld", y, m, d);
+		}
+		if (layer + 1 < depth && fanout > 0) {
+			/* the first task of layer k is the least i such that i * depth / n >= k */
+			first = ((layer + 1) * n + depth - 1) / depth;
+			next = MIN(((layer + 2) * n + depth - 1) / depth, n);
+			size = next - first;
+			window = size * fanout / (fanin > 0 ? fanin : 1);
+			if (window < fanout)
+				window = fanout;
+			if (window > size)
+				window = size;
+			printf(" deps:");
+			for (j = 0; j < fanout && j < window; j++)
+				printf("%stask%ld", j > 0 ? "," : "", first + (long)rnd(window));
+		}
+		printf("\n");
+	}
+}
+
+/* gen: generate synthetic calendar or todo files for benchmarking */
+int
+main(int argc, char *argv[])
+{
+	int mode = 0;
+	int n = 1000;
+	int depth = 4;
+	int fanin = 2;
+	int fanout = 2;
+	int spread = 60;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "cd:i:n:o:r:s:t")) != -1) {
+		switch (ch) {
+		case 'c':
+		case 't':
+			mode = ch;
+			break;
+		case 'd':
+			depth = getint(optarg, 1, INT_MAX);
+			break;
+		case 'i':
+			fanin = getint(optarg, 1, INT_MAX);
+			break;
+		case 'n':
+			n = getint(optarg, 1, INT_MAX);
+			break;
+		case 'o':
+			fanout = getint(optarg, 0, INT_MAX);
+			break;
+		case 'r':
+			spread = getint(optarg, 0, 100000);
+			break;
+		case 's':
+			state = getint(optarg, 1, INT_MAX) * 2654435761ULL;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	if (mode == 'c')
+		gencalendar(n);
+	else if (mode == 't')
+		gentodo(n, depth, fanin, fanout, spread);
+	else
+		usage();
+	if (fflush(stdout) == EOF)
+		err(1, "stdout");
+	return 0;
+}
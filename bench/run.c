@@ -0,0 +1,462 @@
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAXARGS       32                /* maximum number of arguments of a run */
+#define MAXFILES      64                /* maximum number of input files of a workload */
+#define MAXPHASES     8                 /* maximum number of phases reported by a program */
+#define MAXRUNS       100               /* maximum number of runs of each workload */
+#define PHASESIZE     32                /* maximum size of phase names */
+#define TODAY         "2021-05-08"      /* date the workloads are run on, as the generated files */
+
+enum {
+	CACHE_NONE,                     /* the run does not use the cache */
+	CACHE_COLD,                     /* the cache is emptied before each run */
+	CACHE_WARM,                     /* the cache is filled before the runs */
+};
+
+/* workload run by the benchmark */
+struct Workload {
+	const char *name;
+	const char *prog;               /* program to run */
+	const char *gen;                /* arguments of gen for each input file */
+	int count;                      /* events or tasks per input file, scaled by -s */
+	int nfiles;                     /* number of input files */
+	const char *args;               /* arguments of the program, before the files */
+	const char *refargs;            /* arguments of the reference run of the same programs */
+	const char *relargs;            /* arguments of the reference run of a release, or NULL if it cannot run it */
+	int cache;                      /* how the run uses the calendar cache */
+};
+
+/* result of one run of a program */
+struct Result {
+	double wall;                    /* wall-clock time, in seconds */
+	long maxrss;                    /* peak resident set size, in kilobytes */
+	int status;                     /* exit status, or -1 if it did not exit */
+};
+
+/* time of a phase reported by a program */
+struct Phase {
+	char name[PHASESIZE];
+	double secs;                    /* minimum over the runs */
+};
+
+static struct Workload workloads[] = {
+	{ "cal-day",        "calendar", "-c",                       100000, 1,  "-T" TODAY " -n 1",          "-j 1 -T" TODAY " -n 1",   NULL,                     CACHE_NONE },
+	{ "cal-month",      "calendar", "-c",                       100000, 1,  "-T" TODAY " -n 31",         "-j 1 -T" TODAY " -n 31",  NULL,                     CACHE_NONE },
+	{ "cal-year",       "calendar", "-c",                       100000, 1,  "-T" TODAY " -n 365",        "-j 1 -T" TODAY " -n 365", NULL,                     CACHE_NONE },
+	{ "cal-files-j1",   "calendar", "-c",                       10000,  16, "-j 1 -T" TODAY " -n 7",     "-j 1 -T" TODAY " -n 7",   NULL,                     CACHE_NONE },
+	{ "cal-files-j4",   "calendar", "-c",                       10000,  16, "-j 4 -T" TODAY " -n 7",     "-j 1 -T" TODAY " -n 7",   NULL,                     CACHE_NONE },
+	{ "cal-cache-cold", "calendar", "-c",                       25000,  4,  "-T" TODAY " -n 7",          "-j 1 -T" TODAY " -n 7",   NULL,                     CACHE_COLD },
+	{ "cal-cache-warm", "calendar", "-c",                       25000,  4,  "-T" TODAY " -n 7",          "-j 1 -T" TODAY " -n 7",   NULL,                     CACHE_WARM },
+	{ "cal-stream-1",   "calendar", "-c",                       100000, 1,  "-s -T" TODAY " -n 1",       "-j 1 -T" TODAY " -n 1",   NULL,                     CACHE_NONE },
+	{ "cal-stream-365", "calendar", "-c",                       100000, 1,  "-s -T" TODAY " -n 365",     "-j 1 -T" TODAY " -n 365", NULL,                     CACHE_NONE },
+	{ "todo-1k",        "todo",     "-t -d 4",                  1000,   1,  "-T" TODAY,                  "-T" TODAY,                "-T" TODAY,               CACHE_NONE },
+	{ "todo-10k",       "todo",     "-t -d 4",                  10000,  1,  "-T" TODAY,                  "-T" TODAY,                "-T" TODAY,               CACHE_NONE },
+	{ "todo-100k",      "todo",     "-t -d 4",                  100000, 1,  "-T" TODAY,                  "-T" TODAY,                "-T" TODAY,               CACHE_NONE },
+	{ "todo-300k",      "todo",     "-t -d 4",                  300000, 1,  "-T" TODAY,                  "-T" TODAY,                "-T" TODAY,               CACHE_NONE },
+	{ "todo-flat",      "todo",     "-t -d 1",                  20000,  1,  "-T" TODAY,                  "-T" TODAY,                "-T" TODAY,               CACHE_NONE },
+	{ "todo-deep",      "todo",     "-t -d 100 -o 2 -i 2",      20000,  1,  "-l -T" TODAY,               "-l -T" TODAY,             "-l -T" TODAY,            CACHE_NONE },
+	{ "todo-fanin",     "todo",     "-t -d 4 -o 4 -i 50",       20000,  1,  "-l -T" TODAY,               "-l -T" TODAY,             "-l -T" TODAY,            CACHE_NONE },
+	{ "todo-spread",    "todo",     "-t -d 8 -o 3 -i 3 -r 3650", 20000, 1,  "-d -l -T" TODAY,            "-d -l -T" TODAY,          "-d -l -T" TODAY,         CACHE_NONE },
+	{ "todo-files-j1",  "todo",     "-t -d 4",                  20000,  16, "-j 1 -l -T" TODAY,          "-j 1 -l -T" TODAY,        "-l -T" TODAY,            CACHE_NONE },
+	{ "todo-files-j4",  "todo",     "-t -d 4",                  20000,  16, "-j 4 -l -T" TODAY,          "-j 1 -l -T" TODAY,        "-l -T" TODAY,            CACHE_NONE },
+	{ "todo-snap-cold", "todo",     "-t -d 4",                  20000,  16, "-l -T" TODAY,               "-j 1 -l -T" TODAY,        "-l -T" TODAY,            CACHE_COLD },
+	{ "todo-snap-warm", "todo",     "-t -d 4",                  20000,  16, "-l -T" TODAY,               "-j 1 -l -T" TODAY,        "-l -T" TODAY,            CACHE_WARM },
+};
+
+static char *bindir = ".";              /* directory of the programs benchmarked */
+static char *refdir = NULL;             /* directory of the reference release, or NULL to check bindir against itself */
+static char *genpath = "bench/gen";     /* path to the generator */
+static char *workdir = "bench/work";    /* directory for input and output files */
+static int nruns = 3;                   /* number of runs of each workload */
+static int scale = 1;                   /* multiplier of the size of input files */
+
+/* show usage and exit */
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "usage: run [-b bindir] [-g gen] [-n runs] [-r refdir] [-s scale] [-w workdir] [workload...]\n");
+	exit(1);
+}
+
+/* convert string value to int between min and max; exit on error */
+static int
+getint(const char *s, int min, int max)
+{
+	char *end;
+	long n;
+
+	n = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || n < min || n > max)
+		errx(1, "%s: invalid number", s);
+	return n;
+}
+
+/* format into a newly allocated string; exit on error */
+static char *
+format(const char *fmt, ...)
+{
+	va_list ap;
+	char *s;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (s = malloc(n + 1)) == NULL)
+		err(1, "format");
+	va_start(ap, fmt);
+	(void)vsnprintf(s, n + 1, fmt, ap);
+	va_end(ap);
+	return s;
+}
+
+/* split string s (which is changed) on blanks into argv, after *argc arguments */
+static void
+splitargs(char *s, int *argc, char *argv[])
+{
+	char *t;
+
+	for (t = strtok(s, " "); t != NULL; t = strtok(NULL, " ")) {
+		if (*argc >= MAXARGS - 1)
+			errx(1, "too many arguments");
+		argv[(*argc)++] = t;
+	}
+	argv[*argc] = NULL;
+}
+
+/* get the wall-clock time, in seconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Run argv with stdout into the file out, and reporting its phases
+ * into the file prof; get its result.  The program is run by an
+ * intermediate process, whose only child it is, so the resources
+ * that process gets for its children are those of the program alone.
+ */
+static void
+run(char *argv[], const char *out, const char *prof, struct Result *res)
+{
+	struct rusage ru;
+	double start;
+	pid_t pid, child;
+	int fd[2], status, nullfd, outfd;
+
+	if (pipe(fd) == -1)
+		err(1, "pipe");
+	if ((pid = fork()) == -1)
+		err(1, "fork");
+	if (pid == 0) {
+		close(fd[0]);
+		start = now();
+		if ((child = fork()) == -1)
+			err(1, "fork");
+		if (child == 0) {
+			if ((nullfd = open("/dev/null", O_RDWR)) == -1)
+				err(1, "/dev/null");
+			if ((outfd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+				err(1, "%s", out);
+			dup2(nullfd, STDIN_FILENO);
+			dup2(outfd, STDOUT_FILENO);
+			dup2(nullfd, STDERR_FILENO);
+			if (prof != NULL && setenv("ORGUTILS_PROFILE", prof, 1) == -1)
+				err(1, "setenv");
+			execv(argv[0], argv);
+			_exit(127);
+		}
+		if (waitpid(child, &status, 0) == -1)
+			err(1, "waitpid");
+		res->wall = now() - start;
+		res->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+		getrusage(RUSAGE_CHILDREN, &ru);
+		res->maxrss = ru.ru_maxrss;
+		if (write(fd[1], res, sizeof(*res)) != sizeof(*res))
+			_exit(1);
+		_exit(0);
+	}
+	close(fd[1]);
+	if (read(fd[0], res, sizeof(*res)) != sizeof(*res))
+		errx(1, "%s: could not get result", argv[0]);
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+	if (res->status == 127)
+		errx(1, "%s: could not run", argv[0]);
+}
+
+/* compute FNV-1a hash of file contents */
+static uint64_t
+hashfile(const char *path)
+{
+	FILE *fp;
+	uint64_t h = 14695981039346656037ULL;
+	int c;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	while ((c = getc(fp)) != EOF)
+		h = (h ^ (unsigned char)c) * 1099511628211ULL;
+	fclose(fp);
+	return h;
+}
+
+/* remove files of directory */
+static void
+cleardir(const char *dir)
+{
+	struct dirent *ent;
+	DIR *dp;
+	char *path;
+
+	if ((dp = opendir(dir)) == NULL)
+		err(1, "%s", dir);
+	while ((ent = readdir(dp)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+		path = format("%s/%s", dir, ent->d_name);
+		(void)unlink(path);
+		free(path);
+	}
+	closedir(dp);
+}
+
+/* generate the input files of workload, and put their paths into files */
+static void
+generate(struct Workload *wl, char *files[])
+{
+	struct Result res;
+	char *argv[MAXARGS];
+	char *args, *count, *seed;
+	int argc, i;
+
+	for (i = 0; i < wl->nfiles; i++) {
+		files[i] = format("%s/%s.%d", workdir, wl->name, i);
+		args = format("%s", wl->gen);
+		count = format("%d", wl->count * scale);
+		seed = format("%d", i + 1);
+		argc = 0;
+		argv[argc++] = genpath;
+		splitargs(args, &argc, argv);
+		argv[argc++] = "-n";
+		argv[argc++] = count;
+		argv[argc++] = "-s";
+		argv[argc++] = seed;
+		argv[argc] = NULL;
+		run(argv, files[i], NULL, &res);
+		if (res.status != 0)
+			errx(1, "%s: could not generate input", wl->name);
+		free(args);
+		free(count);
+		free(seed);
+	}
+}
+
+/* add the time of each phase in file prof into phases, keeping the minimum of each */
+static void
+addphases(const char *prof, struct Phase phases[], int *nphases)
+{
+	FILE *fp;
+	char name[PHASESIZE];
+	double secs;
+	int i;
+
+	if ((fp = fopen(prof, "r")) == NULL)
+		return;
+	while (fscanf(fp, "%31s %lf", name, &secs) == 2) {
+		for (i = 0; i < *nphases; i++)
+			if (strcmp(phases[i].name, name) == 0)
+				break;
+		if (i == *nphases) {
+			if (*nphases == MAXPHASES)
+				continue;
+			(void)snprintf(phases[i].name, sizeof(phases[i].name), "%s", name);
+			phases[i].secs = secs;
+			(*nphases)++;
+		} else if (secs < phases[i].secs) {
+			phases[i].secs = secs;
+		}
+	}
+	fclose(fp);
+}
+
+/* compare two doubles; used by qsort(3) */
+static int
+comparedouble(const void *a, const void *b)
+{
+	double x, y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Benchmark workload, checking its output against the reference run;
+ * return -1 if they differ.  Without a release in refdir, the reference
+ * is the program of bindir run serially, without cache and without
+ * streaming, so the check is that of the -j, -c and -s variants.
+ * Workloads that a release cannot run are not checked against it.
+ */
+static int
+bench(struct Workload *wl)
+{
+	struct Phase phases[MAXPHASES];
+	struct Result res, ref;
+	double walls[MAXRUNS];
+	long maxrss = 0;
+	uint64_t refhash;
+	char *argv[MAXARGS];
+	char *files[MAXFILES];
+	char *args, *out, *prof, *cachedir;
+	int argc, nphases, i, ok, check;
+
+	generate(wl, files);
+	out = format("%s/%s.out", workdir, wl->name);
+	prof = format("%s/%s.prof", workdir, wl->name);
+	cachedir = format("%s/cache", workdir);
+	if (wl->cache != CACHE_NONE && mkdir(cachedir, 0755) == -1 && errno != EEXIST)
+		err(1, "%s", cachedir);
+
+	/* reference run */
+	refhash = 0;
+	check = (refdir == NULL || wl->relargs != NULL);
+	if (check) {
+		args = format("%s", refdir != NULL ? wl->relargs : wl->refargs);
+		argc = 0;
+		argv[argc++] = format("%s/%s", refdir != NULL ? refdir : bindir, wl->prog);
+		splitargs(args, &argc, argv);
+		for (i = 0; i < wl->nfiles; i++)
+			argv[argc++] = files[i];
+		argv[argc] = NULL;
+		run(argv, out, NULL, &ref);
+		refhash = hashfile(out);
+		free(argv[0]);
+		free(args);
+	}
+
+	/* measured runs */
+	args = format("%s", wl->args);
+	argc = 0;
+	argv[argc++] = format("%s/%s", bindir, wl->prog);
+	if (wl->cache != CACHE_NONE) {
+		argv[argc++] = "-c";
+		argv[argc++] = cachedir;
+		cleardir(cachedir);
+	}
+	splitargs(args, &argc, argv);
+	for (i = 0; i < wl->nfiles; i++)
+		argv[argc++] = files[i];
+	argv[argc] = NULL;
+	if (wl->cache == CACHE_WARM)
+		run(argv, out, NULL, &res);
+	ok = 1;
+	nphases = 0;
+	for (i = 0; i < nruns; i++) {
+		if (wl->cache == CACHE_COLD)
+			cleardir(cachedir);
+		(void)unlink(prof);
+		run(argv, out, prof, &res);
+		walls[i] = res.wall;
+		if (res.maxrss > maxrss)
+			maxrss = res.maxrss;
+		if (check && (res.status != ref.status || hashfile(out) != refhash))
+			ok = 0;
+		addphases(prof, phases, &nphases);
+	}
+	qsort(walls, nruns, sizeof(*walls), comparedouble);
+
+	/* tab-separated line: workload, program, files, runs, times, rss, phases and check */
+	printf("%s\t%s\t%d\t%d\t%.6f\t%.6f\t%ld\t", wl->name, wl->prog, wl->nfiles, nruns,
+	       walls[0], walls[nruns / 2], maxrss);
+	for (i = 0; i < nphases; i++)
+		printf("%s%s=%.6f", i > 0 ? "," : "", phases[i].name, phases[i].secs);
+	printf("%s\t%s\n", nphases == 0 ? "-" : "", !check ? "-" : ok ? "ok" : "FAIL");
+	fflush(stdout);
+
+	free(argv[0]);
+	free(args);
+	for (i = 0; i < wl->nfiles; i++)
+		free(files[i]);
+	free(out);
+	free(prof);
+	free(cachedir);
+	return ok ? 0 : -1;
+}
+
+/* run: benchmark calendar and todo on generated workloads */
+int
+main(int argc, char *argv[])
+{
+	size_t i;
+	int exitval = 0;
+	int found, ch, j;
+
+	while ((ch = getopt(argc, argv, "b:g:n:r:s:w:")) != -1) {
+		switch (ch) {
+		case 'b':
+			bindir = optarg;
+			break;
+		case 'g':
+			genpath = optarg;
+			break;
+		case 'n':
+			nruns = getint(optarg, 1, MAXRUNS);
+			break;
+		case 'r':
+			refdir = optarg;
+			break;
+		case 's':
+			scale = getint(optarg, 1, 1000);
+			break;
+		case 'w':
+			workdir = optarg;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (mkdir(workdir, 0755) == -1 && errno != EEXIST)
+		err(1, "%s", workdir);
+	for (j = 0; j < argc; j++) {
+		found = 0;
+		for (i = 0; i < sizeof(workloads) / sizeof(*workloads); i++)
+			if (strcmp(argv[j], workloads[i].name) == 0)
+				found = 1;
+		if (!found)
+			errx(1, "%s: unknown workload", argv[j]);
+	}
+	printf("workload\tprogram\tfiles\truns\twall_min\twall_median\tmaxrss_kb\tphases\tcheck\n");
+	for (i = 0; i < sizeof(workloads) / sizeof(*workloads); i++) {
+		found = (argc == 0);
+		for (j = 0; j < argc; j++)
+			if (strcmp(argv[j], workloads[i].name) == 0)
+				found = 1;
+		if (found && bench(&workloads[i]) == -1)
+			exitval = 1;
+	}
+	return exitval;
+}
@@ -1,15 +1,78 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 #include "util.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define MATCHX86      1                 /* whether day patterns can be matched with SSE2 or AVX2 */
+#endif
+
+#define NMDAYS        31                /* maximum number of days in a month */
+#define NMONTHS       12
+#define NWDAYS        7
+#define NCYCLEMONTHS  (400 * NMONTHS)   /* months in the 400-year gregorian cycle */
+#define NMWEEKS       5                 /* maximum number of weeks in a month */
+#define NYDAYS        366               /* maximum number of days in a year */
+#define YEARLEN       365.2425          /* mean number of days in a year */
+#define WORDBITS      64
+#define YEARWORDS     ((NYDAYS + WORDBITS - 1) / WORDBITS)
+#define DENSITY       32                /* occurrences per event and year, times log2 of events, from which bitmaps are used */
+#define NAMESIZE      64                /* maximum size of month and weekday names */
+#define CACHEMAGIC    "calcach1"        /* magic number and version of cache files */
+#define NBLOCK        32                /* number of day patterns matched at once */
+#define YEARFAR       INT16_MAX         /* indexed year of patterns of years from INT16_MAX on */
+#define NODAY         INT_MIN           /* no day; -1 is 1969-12-31, a day like any other */
+#define MIN(x,y)      ((x)<(y)?(x):(y))
+#define MAX(x,y)      ((x)>(y)?(x):(y))
+
+/* buckets of the day pattern index (see struct Index) */
+enum {
+	BUCKET_WILD   = 0,
+	BUCKET_MDAY   = BUCKET_WILD + 1,
+	BUCKET_MONTH  = BUCKET_MDAY + NMDAYS,
+	BUCKET_WDAY   = BUCKET_MONTH + NMONTHS,
+	NBUCKETS      = BUCKET_WDAY + NWDAYS,
+};
+
+/* month or weekday name */
+struct Name {
+	struct Name *next;              /* next name with the same first byte */
+	char s[NAMESIZE];
+	size_t len;
+	int value;                      /* month (0 to 11) or weekday (0 to 6) */
+};
+
+/* table of month or weekday names */
+struct NameTable {
+	/*
+	 * Month and weekday names are matched like strptime(3) does for
+	 * %b and %a: case-insensitively, trying each month (or weekday)
+	 * in calendar order, its full name before its abbreviated one.
+	 * Rather than going through the locale for each token (as
+	 * strptime(3) does), the names are gotten once per run, and
+	 * filed by their lowercased first byte, keeping that order.
+	 * A token is then only compared with the names sharing its
+	 * first byte.
+	 */
+	struct Name *first[UCHAR_MAX + 1];
+	struct Name names[2 * NMONTHS];
+	size_t nnames;
+};
+
 /* day pattern */
 struct DPattern {
 	/*
@@ -31,35 +94,352 @@ struct DPattern {
 	 * - 2020/03/11/2/3 matches 11 March 2020.
 	 */
 
-	struct DPattern *next;          /* pointer to next day on linked list */
+	struct Event *event;            /* event the pattern belongs to */
 	int year;
 	int month;
 	int monthday;
 	int monthweek;
 	int weekday;
+
+	/*
+	 * When solving the next occurrence of a pattern, we remember
+	 * the solution and the day it was solved from.  The solution
+	 * still holds for any later day up to the solution itself.
+	 */
+	int from;                       /* day solution was solved from */
+	int solution;                   /* first day matched on or after from */
 };
 
 /* event */
 struct Event {
 	struct Event *next;             /* pointer to next event on linked list */
-	struct DPattern *days;             /* list of day patterns */
-	char *name;                     /* event name */
+	struct DPattern *days;          /* array of day patterns */
+	size_t ndays;                   /* number of day patterns */
+	const char *name;               /* event name, not nul-terminated */
+	size_t namelen;                 /* length of event name */
 	char *filename;                 /* file event came from */
+	size_t seq;                     /* position of event on the list */
+	size_t stamp;                   /* last day the event was matched */
+
+	/*
+	 * Events with the same day patterns occur on the same days, so
+	 * when occurrences are solved (see struct Heap), only the first
+	 * of them is solved; the others are linked after it, in the
+	 * order of the list, and occur with it.
+	 */
+	struct Event *same;             /* next event with the same day patterns */
+	int shared;                     /* whether an earlier event has the same day patterns */
 };
 
 /* collection of events */
 struct Calendar {
+	/*
+	 * Events and their day patterns are allocated from an arena,
+	 * and released all at once; event names are not copied, but
+	 * point into the input lines.  Each event's day
+	 * patterns are contiguous in memory, right after the event.
+	 * While a line is parsed, its day patterns are collected into
+	 * a scratch array, which is reused for every line.
+	 */
+	struct Arena arena;             /* memory for events */
+	struct DPattern *patts;         /* scratch array of day patterns */
+	size_t maxpatts;                /* allocated size of scratch array */
 	struct Event *head, *tail;      /* pointers to singly linked list of events */
+	size_t nevents;                 /* number of events */
+};
+
+/* file parsed into a calendar of its own, when files are parsed in parallel */
+struct Part {
+	struct Calendar calendar;       /* events of the file */
+	struct Input input;             /* lines of the file */
+	char *filename;
+	int retval;                     /* what readfile() returned */
+	struct Warnings warnings;       /* warnings about the file, printed once all files are read */
+};
+
+/* index of day patterns */
+struct Index {
+	/*
+	 * Testing every day pattern against every day is too slow for
+	 * large calendars.  Instead, each day pattern is filed into a
+	 * single bucket: the bucket of its month day, if it has one;
+	 * or the bucket of its month, if it has one; or the bucket of
+	 * its weekday, if it has one; or else the wildcard bucket.
+	 * A given day can then only be matched by the patterns in the
+	 * bucket of its month day, in the bucket of its month, in the
+	 * bucket of its weekday, and in the wildcard bucket.
+	 *
+	 * The buckets are stored contiguously in the arrays of patterns;
+	 * the patterns of bucket i are those from index off[i] up to
+	 * (but not including) index off[i+1].  Patterns that can never
+	 * match (such as 31 February, or 29 February of a common year)
+	 * are not indexed at all.
+	 *
+	 * The fields of the indexed patterns are not reached through
+	 * the patterns, but copied into parallel arrays, narrowed to
+	 * one byte each (or two, for the year); so a bucket is matched
+	 * against a day NBLOCK patterns at a time, with vector
+	 * instructions where there are any (see matchblock).  The
+	 * arrays are padded with NBLOCK patterns that never match, so
+	 * the last block can be read past the last pattern.  Years
+	 * from YEARFAR on do not fit, and are all indexed as YEARFAR;
+	 * the events of patterns matched with such a year are checked
+	 * again against the day.
+	 */
+	struct Event **events;          /* event of each pattern, sorted by bucket */
+	int16_t *year;
+	int8_t *month;
+	int8_t *monthday;
+	int8_t *weekday;
+	int8_t *monthweek;
+	size_t off[NBUCKETS + 1];       /* offset of each bucket in the arrays of patterns */
+	struct Event **matches;         /* events matching the current day */
+	size_t stamp;                   /* number of days matched so far */
+};
+
+/* fields of a day, narrowed as the fields of the indexed patterns */
+struct DayKey {
+	int16_t year;
+	int8_t month;
+	int8_t monthday;
+	int8_t weekday;
+	int8_t pmw;                     /* positive week of the month */
+	int8_t nmw;                     /* negative week of the month */
+};
+
+/* slot of the table of sets of day patterns */
+struct PattSet {
+	uint64_t hash;                  /* hash of the day patterns */
+	struct Event *first;            /* first event with the day patterns; NULL if slot is empty */
+	struct Event *last;             /* last event with the day patterns */
 };
 
+/* next occurrence of an event */
+struct Occurrence {
+	struct Event *event;
+	size_t seq;                     /* position of event, to avoid dereferencing it */
+	int date;                       /* date in unix julian day */
+};
+
+/* queue of events ordered by their next occurrence */
+struct Heap {
+	/*
+	 * Long windows are not matched day by day.  Instead, the date
+	 * of the next occurrence of each event is solved directly from
+	 * its day patterns (see solvepattern()), and the events are
+	 * kept in a binary heap ordered by that date and then by their
+	 * position on the list.  Popping the heap yields the events in
+	 * the order they are printed (but for the events occurring with
+	 * them, see struct Event); a popped event is pushed back with
+	 * its following occurrence, if it is within the window.
+	 */
+	struct Occurrence *occs;
+	size_t noccs;
+};
+
+/* occurrence bitmaps of events */
+struct Bitmap {
+	/*
+	 * When events occur many times each within the window, solving
+	 * their occurrences one by one (see struct Heap) costs more than
+	 * listing all their days at once.  Then, the days of a year on
+	 * which each event occurs are computed into a bitmap, whose i-th
+	 * bit is set if the event occurs on the i-th day of the year.
+	 * A bitmap is the union, over the patterns of the event, of the
+	 * intersection of the masks of the days of the year having each
+	 * field of the pattern (see struct YearMasks); so it is built a
+	 * word at a time.  The window is then read off the bitmaps a
+	 * word, that is WORDBITS days, at a time.  Only the first of the
+	 * events with the same day patterns gets a bitmap.
+	 */
+	struct Event **events;          /* events with a bitmap, in the order of the list */
+	size_t nevents;
+	uint64_t *bits;                 /* YEARWORDS words per event, for the current year */
+	struct Event **sorted;          /* occurrences of the current word, sorted by day */
+	size_t maxsorted;
+};
+
+/* masks of the days of a year, for each value of each field of a day pattern */
+struct YearMasks {
+	/*
+	 * The zeroth mask of each field has the bits of all days of the
+	 * year set, because a zero value matches any day.
+	 */
+	uint64_t month[NMONTHS + 1][YEARWORDS];
+	uint64_t mday[NMDAYS + 1][YEARWORDS];
+	uint64_t wday[NWDAYS + 1][YEARWORDS];
+	uint64_t pmw[NMWEEKS + 1][YEARWORDS];   /* indexed by positive week of month */
+	uint64_t nmw[NMWEEKS + 1][YEARWORDS];   /* indexed by minus negative week of month */
+};
+
+/* occurrences of the events read so far, in streaming mode */
+struct Stream {
+	/*
+	 * With -s, the occurrences of each event within the window are
+	 * solved as soon as its line is read, and nothing else of the
+	 * line is kept: the name of an event is copied into the arena,
+	 * only if it occurs in the window, and each occurrence is
+	 * appended to an array as a key: the day in the window in its
+	 * high half, and the number of the event in its low half; so
+	 * once every file is read, sorting the keys sorts the
+	 * occurrences by day and then by the order of the events.
+	 * So memory grows with the output, not with the input nor
+	 * with the window.
+	 */
+	struct Calendar calendar;       /* scratch array of day patterns */
+	struct Arena arena;             /* events occurring in the window, and their names */
+	struct Event **events;          /* events occurring in the window, in order */
+	size_t nevents, maxevents;
+	uint64_t *keys;                 /* occurrences of those events */
+	size_t nkeys, maxkeys;
+	int first, last;                /* window, in unix julian day */
+};
+
+/* header of calendar cache file */
+struct CacheHeader {
+	/*
+	 * With -c, the events parsed from each file are cached into a
+	 * file keyed by the real path of the input file (see cachepath()),
+	 * whose identity is checked in the header instead.  The header is
+	 * followed by an array of events, an array of the numbers of
+	 * the invalid lines of the file, and an array of the day
+	 * patterns of all events, in order.  Event names are not
+	 * copied into the cache, but kept as offsets into the input
+	 * file; so the cache is only used if the input file still has
+	 * the same contents, and if it is parsed with the same month
+	 * and weekday names.
+	 */
+	char magic[8];
+	uint64_t dev;                   /* device of input file */
+	uint64_t ino;                   /* inode of input file */
+	uint64_t size;                  /* size of input file */
+	int64_t mtime;                  /* modification time, seconds */
+	int64_t mtimensec;              /* modification time, nanoseconds */
+	uint64_t hash;                  /* hash of contents of input file */
+	uint64_t nameshash;             /* hash of month and weekday names */
+	uint64_t nevents;               /* number of events */
+	uint64_t nbad;                  /* number of invalid lines */
+	uint64_t npatts;                /* number of day patterns */
+	uint64_t datahash;              /* hash of the rest of the cache file */
+};
+
+/* cached event */
+struct CacheEvent {
+	uint64_t nameoff;               /* offset of event name into input file */
+	uint32_t namelen;               /* length of event name */
+	uint32_t ndays;                 /* number of day patterns */
+};
+
+/* cached day pattern */
+struct CachePattern {
+	int32_t year;
+	int32_t month;
+	int32_t monthday;
+	int8_t monthweek;
+	int8_t weekday;
+	int8_t pad[2];
+};
+
+/* cache built while a file is parsed */
+struct CacheBuild {
+	struct Calendar *calendar;      /* calendar the file is parsed into */
+	const char *buf;                /* memory-mapped input file */
+	size_t size;                    /* size of input file */
+	size_t off;                     /* offset up to where lines were counted */
+	uint64_t linenum;               /* number of the line at off */
+	struct CacheEvent *evs;
+	size_t nevs, maxevs;
+	uint64_t *bad;                  /* numbers of invalid lines */
+	size_t nbad, maxbad;
+	struct CachePattern *patts;
+	size_t npatts, maxpatts;
+	int failed;                     /* whether the file cannot be cached */
+};
+
+static struct NameTable months;
+static struct NameTable weekdays;
+static uint64_t nameshash;              /* hash of month and weekday names */
+static char *cachedir = NULL;           /* directory of cache files; NULL for no caching */
+
+/* key for the hash of cached files; their contents are not secret */
+static const uint64_t cachekey[2] = { 0x63616c656e646172ULL, 0 };
+
 /* show usage and exit */
 static void
 usage(void)
 {
-	(void)fprintf(stderr, "usage: calendar [-l] [-T YYYY-MM-DD] [-n num] [file ...]\n");
+	(void)fprintf(stderr, "usage: calendar [-ls] [-c cachedir] [-j njobs] [-T YYYY-MM-DD] [-n num] [file ...]\n");
 	exit(1);
 }
 
+/* add name formatted by fmt for tm into table */
+static void
+addname(struct NameTable *table, const char *fmt, struct tm *tm, int value)
+{
+	struct Name *name, **p;
+
+	name = &table->names[table->nnames];
+	if ((name->len = strftime(name->s, sizeof(name->s), fmt, tm)) == 0)
+		return;
+	name->value = value;
+	name->next = NULL;
+	for (p = &table->first[tolower((unsigned char)name->s[0])]; *p != NULL; p = &(*p)->next)
+		;
+	*p = name;
+	table->nnames++;
+}
+
+/* hash names of table, chaining from hash h */
+static uint64_t
+hashnames(struct NameTable *table, uint64_t h)
+{
+	uint64_t key[2];
+	size_t i;
+
+	for (i = 0; i < table->nnames; i++) {
+		key[0] = h;
+		key[1] = table->names[i].value;
+		h = siphash(table->names[i].s, table->names[i].len, key);
+	}
+	return h;
+}
+
+/* get month and weekday names from the current locale */
+static void
+initnames(void)
+{
+	struct tm tm;
+	int i;
+
+	memset(&tm, 0, sizeof(tm));
+	for (i = 0; i < NMONTHS; i++) {
+		tm.tm_mon = i;
+		addname(&months, "%B", &tm, i);
+		addname(&months, "%b", &tm, i);
+	}
+	for (i = 0; i < NWDAYS; i++) {
+		tm.tm_wday = i;
+		addname(&weekdays, "%A", &tm, i);
+		addname(&weekdays, "%a", &tm, i);
+	}
+	nameshash = hashnames(&months, hashnames(&weekdays, 0));
+}
+
+/* match name from table at the beginning of s; return pointer past it, or NULL */
+static const char *
+matchname(struct NameTable *table, const char *s, int *value)
+{
+	struct Name *name;
+
+	for (name = table->first[tolower(*(unsigned char *)s)]; name != NULL; name = name->next) {
+		if (strncasecmp(s, name->s, name->len) == 0) {
+			*value = name->value;
+			return s + name->len;
+		}
+	}
+	return NULL;
+}
+
 /* check if c is separator */
 static int
 isseparator(int c)
@@ -67,203 +447,1553 @@ isseparator(int c)
 	return c == '-' || c == '.' || c == '/';
 }
 
-/* get patterns for event s; also return its name */
-static int
-parseline(void *p, char *line, char *filename)
+/* make room for n members of size bytes in array p of *max members */
+static void *
+growarray(void *p, size_t *max, size_t n, size_t size)
+{
+	if (n <= *max)
+		return p;
+	while (n > *max)
+		*max = (*max == 0) ? 8 : 2 * *max;
+	return ereallocarray(p, *max, size);
+}
+
+/* add event with the first npatts day patterns of the scratch array */
+static void
+addevent(struct Calendar *calendar, size_t npatts, const char *name, size_t namelen, char *filename)
 {
-	struct Calendar *calendar = p;
 	struct Event *ev;
-	struct DPattern *patt, *oldpatt;
+	size_t i;
+
+	ev = arenaalloc(&calendar->arena, sizeof(*ev));
+	ev->next = NULL;
+	ev->days = arenaalloc(&calendar->arena, npatts * sizeof(*ev->days));
+	ev->ndays = npatts;
+	ev->name = name;
+	ev->namelen = namelen;
+	ev->filename = filename;
+	ev->seq = calendar->nevents++;
+	ev->stamp = 0;
+	ev->same = NULL;
+	ev->shared = 0;
+	for (i = 0; i < npatts; i++) {
+		ev->days[i] = calendar->patts[i];
+		ev->days[i].event = ev;
+	}
+	if (calendar->head == NULL)
+		calendar->head = ev;
+	if (calendar->tail != NULL)
+		calendar->tail->next = ev;
+	calendar->tail = ev;
+}
+
+/* skip blanks, but not the newline ending the line */
+static const char *
+skipblanks(const char *s)
+{
+	while (*s != '\n' && isspace(*(unsigned char *)s))
+		s++;
+	return s;
+}
+
+/* convert number at s like strtol(3) does, but without leaving the line */
+static int
+getnum(const char *s, const char **endp)
+{
+	const char *t;
+	long n = 0;
+	int neg = 0;
+
+	t = skipblanks(s);
+	if (*t == '+' || *t == '-')
+		neg = (*t++ == '-');
+	if (!isdigit(*(unsigned char *)t)) {
+		*endp = s;
+		return 0;
+	}
+	for (; isdigit(*(unsigned char *)t); t++)
+		if (n <= INT_MAX)
+			n = n * 10 + (*t - '0');
+	*endp = t;
+	if (n > INT_MAX)
+		return neg ? INT_MIN : INT_MAX;
+	return neg ? -n : n;
+}
+
+/* get day patterns from line up to eol into the scratch array of calendar; return their number, and the rest of the line at *endp */
+static size_t
+getpatterns(struct Calendar *calendar, const char *line, const char *eol, const char **endp)
+{
 	struct DPattern d;
-	struct tm tm;
+	size_t npatts;
 	int n;
-	char *t, *end;
+	const char *t, *end;
 
-	patt = NULL;
+	npatts = 0;
 	for (;;) {
 		d = (struct DPattern){
-			.next = NULL,
+			.event = NULL,
 			.year = 0,
 			.month = 0,
 			.monthday = 0,
 			.monthweek = 0,
 			.weekday = 0,
+			.from = INT_MAX,
+			.solution = NODAY,
 		};
-		while (isspace(*(unsigned char *)line))
-			line++;
-		n = strtol(line, &end, 10);
+		line = skipblanks(line);
+		n = getnum(line, &end);
 		if (n > 0 && isseparator(*end)) {
 			/* got numeric year or month */
 			d.month = n;
 			line = end + 1;
-			n = strtol(line, &end, 10);
+			n = getnum(line, &end);
 			if (n > 0 && isseparator(*end)) {
 				/* got numeric month after year */
 				d.year = d.month;
 				d.month = n;
 				line = end + 1;
-			} else if ((t = strptime(line, "%b", &tm)) != NULL && isseparator(*t)){
+			} else if ((t = matchname(&months, line, &n)) != NULL && isseparator(*t)){
 				/* got month name after year */
 				d.year = d.month;
-				d.month = tm.tm_mon + 1;
+				d.month = n + 1;
 				line = t + 1;
 			}
-		} else if ((t = strptime(line, "%b", &tm)) != NULL && isseparator(*t)) {
+		} else if ((t = matchname(&months, line, &n)) != NULL && isseparator(*t)) {
 			/* got month name */
-			d.month = tm.tm_mon + 1;
+			d.month = n + 1;
 			line = t + 1;
 		}
-		n = strtol(line, &end, 10);
-		if (n > 0 && *end != '\0') {
+		n = getnum(line, &end);
+		if (n > 0 && end < eol) {
 			/* got month day */
 			d.monthday = n;
 			line = end;
 		}
-		if ((t = strptime(line, "%a", &tm)) != NULL) {
+		if ((t = matchname(&weekdays, line, &n)) != NULL) {
 			/* got week day */
-			d.weekday = tm.tm_wday + 1;
+			d.weekday = n + 1;
 			line = t;
 		}
 		if (d.monthday == 0 && d.weekday == 0)
 			break;
-		n = strtol(line, &end, 10);
-		if (n >= -5 && n <= 5 && *end != '\0') {
+		n = getnum(line, &end);
+		if (n >= -5 && n <= 5 && end < eol) {
 			d.monthweek = n;
 			line = end;
 		}
-		oldpatt = patt;
-		patt = emalloc(sizeof(*patt));
-		*patt = d;
-		patt->next = oldpatt;
-		while (isspace(*(unsigned char *)line))
-			line++;
+		calendar->patts = growarray(calendar->patts, &calendar->maxpatts, npatts + 1, sizeof(*calendar->patts));
+		calendar->patts[npatts++] = d;
+		line = skipblanks(line);
 		if (*line == ',') {
 			line++;
 		} else {
 			break;
 		}
 	}
-	if (patt == NULL)
+	*endp = skipblanks(line);
+	return npatts;
+}
+
+/* get patterns for event on line; also get its name */
+static int
+parseline(void *p, const char *line, size_t len, char *filename)
+{
+	struct Calendar *calendar = p;
+	size_t npatts;
+	const char *eol;
+
+	eol = line + len;
+	if ((npatts = getpatterns(calendar, line, eol, &line)) == 0)
 		return -1;
-	while (isspace(*(unsigned char *)line))
-		line++;
-	ev = emalloc(sizeof(*ev));
-	ev->next = NULL;
-	ev->days = patt;
-	ev->name = estrdup(line);
-	ev->filename = filename;
-	if (calendar->head == NULL)
-		calendar->head = ev;
-	if (calendar->tail != NULL)
-		calendar->tail->next = ev;
-	calendar->tail = ev;
+	addevent(calendar, npatts, line, eol - line, filename);
 	return 0;
 }
 
-/* check if event occurs today */
+/* parse line into the calendar of build, and add its event or its number to the cache */
+static int
+cacheline(void *p, const char *line, size_t len, char *filename)
+{
+	struct CacheBuild *build = p;
+	struct CacheEvent *cev;
+	struct CachePattern *cp;
+	struct Event *ev;
+	size_t off, i;
+
+	/* a line not in the mapping is the copied last line, which ends the file */
+	if (line >= build->buf && line < build->buf + build->size)
+		off = line - build->buf;
+	else
+		off = build->size - len;
+	if (parseline(build->calendar, line, len, filename) == -1) {
+		for (; build->off < off; build->off++)
+			if (build->buf[build->off] == '\n')
+				build->linenum++;
+		build->bad = growarray(build->bad, &build->maxbad, build->nbad + 1, sizeof(*build->bad));
+		build->bad[build->nbad++] = build->linenum;
+		return -1;
+	}
+	ev = build->calendar->tail;
+	if (ev->namelen > UINT32_MAX || ev->ndays > UINT32_MAX)
+		build->failed = 1;
+	build->evs = growarray(build->evs, &build->maxevs, build->nevs + 1, sizeof(*build->evs));
+	cev = &build->evs[build->nevs++];
+	cev->nameoff = off + (ev->name - line);
+	cev->namelen = ev->namelen;
+	cev->ndays = ev->ndays;
+	build->patts = growarray(build->patts, &build->maxpatts, build->npatts + ev->ndays, sizeof(*build->patts));
+	for (i = 0; i < ev->ndays; i++) {
+		cp = &build->patts[build->npatts++];
+		cp->year = ev->days[i].year;
+		cp->month = ev->days[i].month;
+		cp->monthday = ev->days[i].monthday;
+		cp->monthweek = ev->days[i].monthweek;
+		cp->weekday = ev->days[i].weekday;
+		cp->pad[0] = cp->pad[1] = 0;
+	}
+	return 0;
+}
+
+/* hash the events, invalid line numbers and day patterns of a cache */
+static uint64_t
+hashcache(const struct CacheEvent *evs, size_t nevs, const uint64_t *bad, size_t nbad,
+          const struct CachePattern *patts, size_t npatts)
+{
+	uint64_t key[2];
+
+	key[0] = siphash(evs, nevs * sizeof(*evs), cachekey);
+	key[1] = siphash(bad, nbad * sizeof(*bad), cachekey);
+	return siphash(patts, npatts * sizeof(*patts), key);
+}
+
+/* check whether cached day pattern could have been parsed by parseline() */
 static int
-occurstoday(struct Date *today, struct DPattern *patts)
+isvalidpattern(const struct CachePattern *cp)
 {
+	return cp->year >= 0 && cp->month >= 0 && cp->monthday >= 0 &&
+	       cp->monthweek >= -5 && cp->monthweek <= 5 &&
+	       cp->weekday >= 0 && cp->weekday <= NWDAYS &&
+	       (cp->monthday > 0 || cp->weekday > 0);
+}
+
+/* add events of file from the cache at path, if it matches hdr; return -1 if it is stale or corrupt */
+static int
+loadcache(struct Calendar *calendar, const char *path, const struct CacheHeader *hdr, const char *buf, char *filename, int *retval)
+{
+	const struct CacheHeader *h;
+	const struct CacheEvent *evs;
+	const struct CachePattern *patts;
+	const uint64_t *bad;
 	struct DPattern *d;
+	struct stat st;
+	size_t size, i, j, k;
+	void *map;
+	int fd;
 
-	for (d = patts; d != NULL; d = d->next) {
-		if ((d->year == 0 || d->year == today->y) &&
-		    (d->month == 0 || d->month == today->m) &&
-		    (d->monthday == 0 || d->monthday == today->d) &&
-		    (d->weekday == 0 || d->weekday == today->w + 1) &&
-		    (d->monthweek == 0 ||
-		     (d->monthweek < 0 && d->monthweek == today->nmw) || 
-		     (d->monthweek == today->pmw))) {
-			return 1;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (uintmax_t)st.st_size < sizeof(*h) ||
+	    (uintmax_t)st.st_size > SIZE_MAX ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	size = st.st_size;
+	h = map;
+	evs = (const struct CacheEvent *)(h + 1);
+	if (memcmp(h, hdr, offsetof(struct CacheHeader, nevents)) != 0 ||
+	    h->nevents > (size - sizeof(*h)) / sizeof(*evs))
+		goto stale;
+	bad = (const uint64_t *)(evs + h->nevents);
+	if (h->nbad > (size - ((const char *)bad - (const char *)map)) / sizeof(*bad))
+		goto stale;
+	patts = (const struct CachePattern *)(bad + h->nbad);
+	if (h->npatts != (size - ((const char *)patts - (const char *)map)) / sizeof(*patts) ||
+	    size != (size_t)((const char *)(patts + h->npatts) - (const char *)map))
+		goto stale;
+
+	/* check everything before adding any event, for a corrupt cache to be ignored as a whole */
+	for (i = j = 0; i < h->nevents; i++) {
+		if (evs[i].nameoff > hdr->size || evs[i].namelen > hdr->size - evs[i].nameoff ||
+		    evs[i].ndays == 0 || evs[i].ndays > h->npatts - j)
+			goto stale;
+		for (k = 0; k < evs[i].ndays; k++, j++)
+			if (!isvalidpattern(&patts[j]))
+				goto stale;
+	}
+	if (j != h->npatts || h->datahash != hashcache(evs, h->nevents, bad, h->nbad, patts, h->npatts))
+		goto stale;
+
+	for (i = j = 0; i < h->nevents; i++) {
+		calendar->patts = growarray(calendar->patts, &calendar->maxpatts, evs[i].ndays, sizeof(*calendar->patts));
+		for (k = 0; k < evs[i].ndays; k++, j++) {
+			d = &calendar->patts[k];
+			*d = (struct DPattern){
+				.event = NULL,
+				.year = patts[j].year,
+				.month = patts[j].month,
+				.monthday = patts[j].monthday,
+				.monthweek = patts[j].monthweek,
+				.weekday = patts[j].weekday,
+				.from = INT_MAX,
+				.solution = NODAY,
+			};
 		}
+		addevent(calendar, evs[i].ndays, buf + evs[i].nameoff, evs[i].namelen, filename);
+	}
+	*retval = 0;
+	for (i = 0; i < h->nbad; i++) {
+		warnmsg("%s:%ju: invalid line", filename, (uintmax_t)bad[i]);
+		*retval = -1;
 	}
+	munmap(map, size);
 	return 0;
+stale:
+	munmap(map, size);
+	return -1;
 }
 
-/* print events for today and after days */
+/* write cache built while parsing a file into path, replacing it; the cache is optional, so errors are ignored */
 static void
-printcalendar(struct Calendar *calendar, struct Date *today, int after, int lflag, int prefix)
+writecache(const char *path, struct CacheHeader *hdr, struct CacheBuild *build)
 {
-	struct tm tm;
+	char tmp[PATH_MAX];
+	int fd;
+
+	if (build->failed)
+		return;
+	hdr->nevents = build->nevs;
+	hdr->nbad = build->nbad;
+	hdr->npatts = build->npatts;
+	hdr->datahash = hashcache(build->evs, build->nevs, build->bad, build->nbad, build->patts, build->npatts);
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+		return;
+	if ((fd = mkstemp(tmp)) == -1)
+		return;
+	if (writefile(fd, hdr, sizeof(*hdr)) == -1 ||
+	    writefile(fd, build->evs, build->nevs * sizeof(*build->evs)) == -1 ||
+	    writefile(fd, build->bad, build->nbad * sizeof(*build->bad)) == -1 ||
+	    writefile(fd, build->patts, build->npatts * sizeof(*build->patts)) == -1) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	if (close(fd) == -1 || rename(tmp, path) == -1)
+		unlink(tmp);
+}
+
+/* read events from file, going through its cache if there is a cache directory; return like readfile() */
+static int
+readcalendar(struct Calendar *calendar, struct Input *in, char *filename)
+{
+	struct CacheBuild build;
+	struct CacheHeader hdr;
+	struct stat st;
+	const char *buf;
+	char path[PATH_MAX];
+	int fd, retval;
+
+	if (cachedir == NULL || strcmp(filename, "-") == 0)
+		return readfile(parseline, calendar, in, filename);
+	if ((fd = open(filename, O_RDONLY)) == -1)
+		return readfile(parseline, calendar, in, filename);
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (buf = mapinput(in, fd, &st)) == NULL) {
+		close(fd);
+		return readfile(parseline, calendar, in, filename);
+	}
+	close(fd);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHEMAGIC, sizeof(hdr.magic));
+	hdr.dev = st.st_dev;
+	hdr.ino = st.st_ino;
+	hdr.size = st.st_size;
+	hdr.mtime = st.st_mtim.tv_sec;
+	hdr.mtimensec = st.st_mtim.tv_nsec;
+	hdr.hash = siphash(buf, st.st_size, cachekey);
+	hdr.nameshash = nameshash;
+	if (cachepath(path, sizeof(path), cachedir, "calendar", filename) == -1)
+		return maplines(parseline, calendar, in, buf, st.st_size, filename);
+	if (loadcache(calendar, path, &hdr, buf, filename, &retval) == 0)
+		return retval;
+	memset(&build, 0, sizeof(build));
+	build.calendar = calendar;
+	build.buf = buf;
+	build.size = st.st_size;
+	build.linenum = 1;
+	retval = maplines(cacheline, &build, in, buf, st.st_size, filename);
+	writecache(path, &hdr, &build);
+	free(build.evs);
+	free(build.bad);
+	free(build.patts);
+	return retval;
+}
+
+/* check if day pattern matches today */
+static int
+occurstoday(struct Date *today, struct DPattern *d)
+{
+	return (d->year == 0 || d->year == today->y) &&
+	       (d->month == 0 || d->month == today->m) &&
+	       (d->monthday == 0 || d->monthday == today->d) &&
+	       (d->weekday == 0 || d->weekday == today->w + 1) &&
+	       (d->monthweek == 0 ||
+	        (d->monthweek < 0 && d->monthweek == today->nmw) ||
+	        (d->monthweek == today->pmw));
+}
+
+/* get index bucket for day pattern; return -1 if it can never match */
+static int
+getbucket(struct DPattern *d)
+{
+	if (d->monthday < 0 || d->monthday > NMDAYS)
+		return -1;
+	if (d->month < 0 || d->month > NMONTHS)
+		return -1;
+	if (d->weekday < 0 || d->weekday > NWDAYS)
+		return -1;
+
+	/* any year (0) is taken as leap, for 29 February to be indexed */
+	if (d->month > 0 && d->monthday > daysinmonth(d->year, d->month))
+		return -1;
+	if (d->monthday > 0)
+		return BUCKET_MDAY + d->monthday - 1;
+	if (d->month > 0)
+		return BUCKET_MONTH + d->month - 1;
+	if (d->weekday > 0)
+		return BUCKET_WDAY + d->weekday - 1;
+	return BUCKET_WILD;
+}
+
+/* compare two day patterns field by field; used by qsort(3) */
+static int
+comparepattern(const void *a, const void *b)
+{
+	const struct DPattern *da, *db;
+
+	da = a;
+	db = b;
+	if (da->year != db->year)
+		return (da->year < db->year) ? -1 : +1;
+	if (da->month != db->month)
+		return (da->month < db->month) ? -1 : +1;
+	if (da->monthday != db->monthday)
+		return (da->monthday < db->monthday) ? -1 : +1;
+	if (da->monthweek != db->monthweek)
+		return (da->monthweek < db->monthweek) ? -1 : +1;
+	if (da->weekday != db->weekday)
+		return (da->weekday < db->weekday) ? -1 : +1;
+	return 0;
+}
+
+/* sort day patterns of event by insertion, as there are only a few of them */
+static void
+sortdays(struct Event *ev)
+{
+	struct DPattern tmp;
+	size_t i, j;
+
+	for (i = 1; i < ev->ndays; i++) {
+		if (comparepattern(&ev->days[i - 1], &ev->days[i]) <= 0)
+			continue;
+		tmp = ev->days[i];
+		for (j = i; j > 0 && comparepattern(&ev->days[j - 1], &tmp) > 0; j--)
+			ev->days[j] = ev->days[j - 1];
+		ev->days[j] = tmp;
+	}
+}
+
+/* compute hash value of the day patterns of event */
+static uint64_t
+hashdays(struct Event *ev)
+{
+	struct DPattern *d;
+	uint64_t h;
+	size_t i;
+
+	h = 14695981039346656037ULL ^ ev->ndays;
+	for (i = 0; i < ev->ndays; i++) {
+		d = &ev->days[i];
+		h = (h ^ (uint32_t)d->year) * 1099511628211ULL;
+		h = (h ^ (uint32_t)d->month) * 1099511628211ULL;
+		h = (h ^ (uint32_t)d->monthday) * 1099511628211ULL;
+		h = (h ^ (uint32_t)d->monthweek) * 1099511628211ULL;
+		h = (h ^ (uint32_t)d->weekday) * 1099511628211ULL;
+	}
+
+	/* the low bits of h only depend on the low bits of the fields; mix the high ones into them */
+	h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+	h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h >> 33);
+}
+
+/*
+ * Link each event after the first earlier one with the same set of
+ * day patterns, if any; return the number of events so linked.  The
+ * order of the day patterns of an event does not matter, so they are
+ * sorted first, for sets listed in different orders to be the same.
+ */
+static size_t
+dedupevents(struct Calendar *calendar)
+{
+	struct PattSet *tab, *set;
 	struct Event *ev;
+	uint64_t h;
+	size_t size, b, i, nshared;
+
+	for (size = 16; size < 2 * calendar->nevents; size *= 2)
+		;
+	tab = ecalloc(size, sizeof(*tab));
+	nshared = 0;
+	for (ev = calendar->head; ev != NULL; ev = ev->next) {
+		sortdays(ev);
+		h = hashdays(ev);
+		for (b = h & (size - 1); tab[b].first != NULL; b = (b + 1) & (size - 1)) {
+			set = &tab[b];
+			if (set->hash != h || set->first->ndays != ev->ndays)
+				continue;
+			for (i = 0; i < ev->ndays; i++)
+				if (comparepattern(&set->first->days[i], &ev->days[i]) != 0)
+					break;
+			if (i == ev->ndays)
+				break;
+		}
+		set = &tab[b];
+		if (set->first == NULL) {
+			set->hash = h;
+			set->first = ev;
+		} else {
+			set->last->same = ev;
+			ev->shared = 1;
+			nshared++;
+		}
+		set->last = ev;
+	}
+	free(tab);
+	return nshared;
+}
+
+/* get year of day pattern or day as indexed */
+static int
+indexyear(int year)
+{
+	if (year <= 0)
+		return 0;
+	return (year < YEARFAR) ? year : YEARFAR;
+}
+
+/* test day against NBLOCK patterns from the i-th one of index, one by one; get mask of those matching */
+static uint32_t
+matchscalar(struct Index *index, size_t i, struct DayKey *key)
+{
+	uint32_t mask = 0;
+	size_t j;
+
+	for (j = 0; j < NBLOCK; j++, i++) {
+		if ((index->year[i] == 0 || index->year[i] == key->year) &&
+		    (index->month[i] == 0 || index->month[i] == key->month) &&
+		    (index->monthday[i] == 0 || index->monthday[i] == key->monthday) &&
+		    (index->weekday[i] == 0 || index->weekday[i] == key->weekday) &&
+		    (index->monthweek[i] == 0 || index->monthweek[i] == key->pmw ||
+		     index->monthweek[i] == key->nmw))
+			mask |= (uint32_t)1 << j;
+	}
+	return mask;
+}
+
+#ifdef MATCHX86
+/* test 16 byte fields at p against value v; get 0xFF for those equal to it or zero */
+static __m128i
+match16(const int8_t *p, int v)
+{
+	__m128i f;
+
+	f = _mm_loadu_si128((const __m128i *)p);
+	return _mm_or_si128(_mm_cmpeq_epi8(f, _mm_setzero_si128()), _mm_cmpeq_epi8(f, _mm_set1_epi8(v)));
+}
+
+/* like matchscalar(), 16 patterns at a time, with SSE2 */
+static uint32_t
+matchsse2(struct Index *index, size_t i, struct DayKey *key)
+{
+	__m128i lo, hi, m, zero, year;
+	uint32_t mask = 0;
+	size_t j;
+
+	zero = _mm_setzero_si128();
+	year = _mm_set1_epi16(key->year);
+	for (j = 0; j < NBLOCK; j += 16, i += 16) {
+		lo = _mm_loadu_si128((const __m128i *)(index->year + i));
+		hi = _mm_loadu_si128((const __m128i *)(index->year + i + 8));
+		lo = _mm_or_si128(_mm_cmpeq_epi16(lo, zero), _mm_cmpeq_epi16(lo, year));
+		hi = _mm_or_si128(_mm_cmpeq_epi16(hi, zero), _mm_cmpeq_epi16(hi, year));
+		m = _mm_packs_epi16(lo, hi);
+		m = _mm_and_si128(m, match16(index->month + i, key->month));
+		m = _mm_and_si128(m, match16(index->monthday + i, key->monthday));
+		m = _mm_and_si128(m, match16(index->weekday + i, key->weekday));
+		m = _mm_and_si128(m, _mm_or_si128(match16(index->monthweek + i, key->pmw),
+		                                  _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(index->monthweek + i)),
+		                                                 _mm_set1_epi8(key->nmw))));
+		mask |= (uint32_t)_mm_movemask_epi8(m) << j;
+	}
+	return mask;
+}
+
+/* test 32 byte fields at p against value v; get 0xFF for those equal to it or zero */
+__attribute__((target("avx2")))
+static __m256i
+match32(const int8_t *p, int v)
+{
+	__m256i f;
+
+	f = _mm256_loadu_si256((const __m256i *)p);
+	return _mm256_or_si256(_mm256_cmpeq_epi8(f, _mm256_setzero_si256()), _mm256_cmpeq_epi8(f, _mm256_set1_epi8(v)));
+}
+
+/* like matchscalar(), 32 patterns at a time, with AVX2 */
+__attribute__((target("avx2")))
+static uint32_t
+matchavx2(struct Index *index, size_t i, struct DayKey *key)
+{
+	__m256i lo, hi, m, zero, year;
+
+	zero = _mm256_setzero_si256();
+	year = _mm256_set1_epi16(key->year);
+	lo = _mm256_loadu_si256((const __m256i *)(index->year + i));
+	hi = _mm256_loadu_si256((const __m256i *)(index->year + i + 16));
+	lo = _mm256_or_si256(_mm256_cmpeq_epi16(lo, zero), _mm256_cmpeq_epi16(lo, year));
+	hi = _mm256_or_si256(_mm256_cmpeq_epi16(hi, zero), _mm256_cmpeq_epi16(hi, year));
+
+	/* packing works within each half of the registers, so put the quarters back in order */
+	m = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+	m = _mm256_and_si256(m, match32(index->month + i, key->month));
+	m = _mm256_and_si256(m, match32(index->monthday + i, key->monthday));
+	m = _mm256_and_si256(m, match32(index->weekday + i, key->weekday));
+	m = _mm256_and_si256(m, _mm256_or_si256(match32(index->monthweek + i, key->pmw),
+	                                        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(index->monthweek + i)),
+	                                                          _mm256_set1_epi8(key->nmw))));
+	return (uint32_t)_mm256_movemask_epi8(m);
+}
+#endif
+
+/* function matching a block of patterns, the fastest one the processor runs (see buildindex) */
+static uint32_t (*matchblock)(struct Index *, size_t, struct DayKey *) = matchscalar;
+
+/* file day patterns of calendar into the buckets of index */
+static void
+buildindex(struct Calendar *calendar, struct Index *index)
+{
+	struct DPattern *d;
+	struct Event *ev;
+	size_t i, j, n;
+	int b;
+
+#ifdef MATCHX86
+	__builtin_cpu_init();
+	matchblock = __builtin_cpu_supports("avx2") ? matchavx2 : matchsse2;
+#endif
+	memset(index->off, 0, sizeof(index->off));
+	for (ev = calendar->head; ev != NULL; ev = ev->next)
+		for (i = 0; i < ev->ndays; i++)
+			if ((b = getbucket(&ev->days[i])) != -1)
+				index->off[b + 1]++;
+	for (i = 0; i < NBUCKETS; i++)
+		index->off[i + 1] += index->off[i];
+	n = index->off[NBUCKETS] + NBLOCK;
+	index->events = ecalloc(n, sizeof(*index->events));
+	index->year = ecalloc(n, sizeof(*index->year));
+	index->month = ecalloc(n, sizeof(*index->month));
+	index->monthday = ecalloc(n, sizeof(*index->monthday));
+	index->weekday = ecalloc(n, sizeof(*index->weekday));
+	index->monthweek = ecalloc(n, sizeof(*index->monthweek));
+	index->matches = ecalloc(calendar->nevents + 1, sizeof(*index->matches));
+	index->stamp = 0;
+	for (ev = calendar->head; ev != NULL; ev = ev->next) {
+		for (i = 0; i < ev->ndays; i++) {
+			d = &ev->days[i];
+			if ((b = getbucket(d)) == -1)
+				continue;
+			j = index->off[b]++;
+			index->events[j] = ev;
+			index->year[j] = indexyear(d->year);
+			index->month[j] = d->month;
+			index->monthday[j] = d->monthday;
+			index->weekday[j] = d->weekday;
+			index->monthweek[j] = d->monthweek;
+		}
+	}
+	for (i = NBUCKETS; i > 0; i--)
+		index->off[i] = index->off[i - 1];
+	index->off[0] = 0;
+
+	/* no day has a negative month day */
+	for (j = index->off[NBUCKETS]; j < n; j++)
+		index->monthday[j] = -1;
+}
+
+/* compare the position of two events; used by qsort(3) */
+static int
+compareevent(const void *a, const void *b)
+{
+	struct Event *eva, *evb;
+
+	eva = *(struct Event **)a;
+	evb = *(struct Event **)b;
+	if (eva->seq < evb->seq)
+		return -1;
+	if (eva->seq > evb->seq)
+		return +1;
+	return 0;
+}
+
+/* check if event occurs today */
+static int
+occursevent(struct Date *today, struct Event *ev)
+{
+	size_t i;
+
+	for (i = 0; i < ev->ndays; i++)
+		if (occurstoday(today, &ev->days[i]))
+			return 1;
+	return 0;
+}
+
+/* collect events from bucket b occurring today; return new number of matches */
+static size_t
+matchbucket(struct Index *index, int b, struct Date *today, struct DayKey *key, size_t nmatches)
+{
+	struct Event *ev;
+	uint32_t mask;
+	size_t i, j;
+
+	for (i = index->off[b]; i < index->off[b + 1]; i += NBLOCK) {
+		mask = (*matchblock)(index, i, key);
+		if (index->off[b + 1] - i < NBLOCK)
+			mask &= ((uint32_t)1 << (index->off[b + 1] - i)) - 1;
+		for (; mask != 0; mask &= mask - 1) {
+			j = i + ffs(mask) - 1;
+			ev = index->events[j];
+			if (ev->stamp == index->stamp)
+				continue;
+			if (index->year[j] == YEARFAR && !occursevent(today, ev))
+				continue;
+			ev->stamp = index->stamp;
+			index->matches[nmatches++] = ev;
+		}
+	}
+	return nmatches;
+}
+
+/* collect events occurring today, in no particular order; return their number */
+static size_t
+matchday(struct Index *index, struct Date *today)
+{
+	struct DayKey key;
+	size_t nmatches;
+
+	key.year = indexyear(today->y);
+	key.month = today->m;
+	key.monthday = today->d;
+	key.weekday = today->w + 1;
+	key.pmw = today->pmw;
+	key.nmw = today->nmw;
+	index->stamp++;
+	nmatches = matchbucket(index, BUCKET_WILD, today, &key, 0);
+	nmatches = matchbucket(index, BUCKET_MDAY + today->d - 1, today, &key, nmatches);
+	nmatches = matchbucket(index, BUCKET_MONTH + today->m - 1, today, &key, nmatches);
+	nmatches = matchbucket(index, BUCKET_WDAY + today->w, today, &key, nmatches);
+	return nmatches;
+}
+
+/* get first day in month of year, on or after month day first, matched by pattern; return NODAY if there is none */
+static int
+solvemonth(struct DPattern *d, int y, int m, int first)
+{
+	struct Date day;
+	int last, date, skip;
+
+	last = daysinmonth(y, m);
+	if (d->monthweek > 0) {
+		/* positive week k spans month days 7k-6 to 7k */
+		first = MAX(first, NWDAYS * d->monthweek - NWDAYS + 1);
+		last = MIN(last, NWDAYS * d->monthweek);
+	} else if (d->monthweek < 0) {
+		/* negative week -k spans the 7 days ending 7(k-1) days before the last one */
+		first = MAX(first, last + NWDAYS * d->monthweek + 1);
+		last = MIN(last, last + NWDAYS * d->monthweek + NWDAYS);
+	}
+	if (d->monthday != 0) {
+		first = MAX(first, d->monthday);
+		last = MIN(last, d->monthday);
+	}
+	if (first > last)
+		return NODAY;
+	day.y = y;
+	day.m = m;
+	day.d = first;
+	date = datetojulian(&day);
+	if (d->weekday != 0) {
+		/* skip to the first day on the weekday of the pattern; 1970-01-01 was a Thursday */
+		day.w = ((date + THURSDAY) % NWDAYS + NWDAYS) % NWDAYS;
+		skip = (d->weekday - 1 - day.w + NWDAYS) % NWDAYS;
+		first += skip;
+		date += skip;
+	}
+	return (first <= last) ? date : NODAY;
+}
+
+/* get first day on or after a given day matched by pattern; return NODAY if there is none */
+static int
+solvepattern(struct DPattern *d, struct Date *day)
+{
+	int y, m, first, date, i;
+
+	if (getbucket(d) == -1)
+		return NODAY;
+	y = day->y;
+	m = day->m;
+	first = day->d;
+
+	/* days repeat every 400 years, so give up if nothing matches within them */
+	for (i = 0; i < NCYCLEMONTHS; i++) {
+		if (d->year != 0 && y > d->year)
+			return NODAY;
+		if (d->year != 0 && y < d->year) {
+			y = d->year;
+			m = 1;
+			first = 1;
+		}
+		if (d->month != 0 && m != d->month) {
+			if (m > d->month)
+				y++;
+			m = d->month;
+			first = 1;
+			continue;
+		}
+		if ((date = solvemonth(d, y, m, first)) != NODAY)
+			return date;
+		first = 1;
+		if (++m > NMONTHS) {
+			m = 1;
+			y++;
+		}
+	}
+	return NODAY;
+}
+
+/* get first day on or after date in which event occurs; return NODAY if there is none */
+static int
+solveevent(struct Event *ev, int date)
+{
+	struct DPattern *d;
+	struct Date day;
+	size_t i;
+	int next, n;
+
+	day.y = 0;
+	next = NODAY;
+	for (i = 0; i < ev->ndays; i++) {
+		d = &ev->days[i];
+		if (d->from > date || (d->solution != NODAY && d->solution < date)) {
+			if (day.y == 0)
+				juliantodate(&day, date);
+			d->from = date;
+			d->solution = solvepattern(d, &day);
+		}
+		if ((n = d->solution) != NODAY && (next == NODAY || n < next))
+			next = n;
+	}
+	return next;
+}
+
+/* check whether occurrence a comes before occurrence b */
+static int
+isbefore(struct Occurrence *a, struct Occurrence *b)
+{
+	if (a->date != b->date)
+		return a->date < b->date;
+	return a->seq < b->seq;
+}
+
+/* move the occurrence at position i of heap down into its place */
+static void
+siftdown(struct Heap *heap, size_t i)
+{
+	struct Occurrence tmp;
+	size_t min, child;
+
+	for (;;) {
+		min = i;
+		child = 2 * i + 1;
+		if (child < heap->noccs && isbefore(&heap->occs[child], &heap->occs[min]))
+			min = child;
+		if (child + 1 < heap->noccs && isbefore(&heap->occs[child + 1], &heap->occs[min]))
+			min = child + 1;
+		if (min == i)
+			return;
+		tmp = heap->occs[i];
+		heap->occs[i] = heap->occs[min];
+		heap->occs[min] = tmp;
+		i = min;
+	}
+}
+
+/* replace the first occurrence of the heap with the next occurrence of its event, if it is up to last */
+static void
+advanceheap(struct Heap *heap, int last)
+{
+	struct Occurrence *occ;
+
+	occ = &heap->occs[0];
+	if (occ->date == last || (occ->date = solveevent(occ->event, occ->date + 1)) == NODAY || occ->date > last)
+		*occ = heap->occs[--heap->noccs];
+	siftdown(heap, 0);
+}
+
+/*
+ * Add to the nevs events at evs, in the order of the list, the events
+ * occurring with them, keeping that order; return the new number of
+ * events.  Each event begins a list of events in order, so the lists
+ * are merged through heap, which starts with the first events: being
+ * in order, they are already a heap.
+ */
+static size_t
+mergeshared(struct Heap *heap, struct Event **evs, size_t nevs)
+{
+	struct Occurrence *occ;
+	size_t i, n;
+
+	heap->noccs = 0;
+	for (i = 0; i < nevs; i++) {
+		heap->occs[i].event = evs[i];
+		heap->occs[i].seq = evs[i]->seq;
+		heap->occs[i].date = 0;
+		if (evs[i]->same != NULL)
+			heap->noccs = nevs;
+	}
+	if (heap->noccs == 0)
+		return nevs;
+	for (n = 0; heap->noccs > 0; n++) {
+		occ = &heap->occs[0];
+		evs[n] = occ->event;
+		if (occ->event->same != NULL) {
+			occ->event = occ->event->same;
+			occ->seq = occ->event->seq;
+		} else {
+			*occ = heap->occs[--heap->noccs];
+		}
+		siftdown(heap, 0);
+	}
+	return n;
+}
+
+/* fill heap with the first occurrences of events from first to last */
+static void
+buildheap(struct Calendar *calendar, struct Heap *heap, int first, int last)
+{
+	struct Event *ev;
+	size_t i;
+	int date;
+
+	heap->occs = ecalloc(calendar->nevents + 1, sizeof(*heap->occs));
+	heap->noccs = 0;
+	for (ev = calendar->head; ev != NULL; ev = ev->next) {
+		if (ev->shared)
+			continue;
+		if ((date = solveevent(ev, first)) == NODAY || date > last)
+			continue;
+		heap->occs[heap->noccs].event = ev;
+		heap->occs[heap->noccs].seq = ev->seq;
+		heap->occs[heap->noccs].date = date;
+		heap->noccs++;
+	}
+	for (i = heap->noccs / 2; i > 0; i--)
+		siftdown(heap, i - 1);
+}
+
+/* print events of today */
+static void
+printday(struct Date *today, struct Event **evs, size_t nevs, int lflag, int prefix)
+{
+	struct tm tm;
+	size_t i, len;
 	char buf1[128];
 	char buf2[128];
 
-	buf1[0] = buf2[0] = '\0';
-	while (after-- >= 0) {
-		tm.tm_year = today->y - 1900;
-		tm.tm_wday = today->w;
-		tm.tm_mday = today->d;
-		tm.tm_mon = today->m - 1;
-		if (lflag) {
-			strftime(buf1, sizeof(buf1), "%A", &tm);
-			strftime(buf2, sizeof(buf2), "%d %B %Y", &tm);
-			printf("%-10s %s\n", buf1, buf2);
-		} else {
-			strftime(buf1, sizeof(buf1), "%m-%d", &tm);
+	/* format the header of the day once, and then copy it for each event */
+	tm.tm_year = today->y - 1900;
+	tm.tm_wday = today->w;
+	tm.tm_mday = today->d;
+	tm.tm_mon = today->m - 1;
+	len = 0;
+	if (lflag) {
+		len = strftime(buf1, sizeof(buf1) - 1, "%A", &tm);
+		for (; len < 10; len++)
+			buf1[len] = ' ';
+		buf1[len++] = ' ';
+		outbytes(buf1, len);
+		len = strftime(buf2, sizeof(buf2) - 1, "%d %B %Y", &tm);
+		buf2[len++] = '\n';
+		outbytes(buf2, len);
+		len = 0;
+	} else {
+		len = strftime(buf1, sizeof(buf1) - 1, "%m-%d", &tm);
+	}
+	buf1[len++] = '\t';
+	for (i = 0; i < nevs; i++) {
+		outbytes(buf1, len);
+		if (prefix) {
+			outstr(evs[i]->filename);
+			outbytes(": ", 2);
 		}
-		for (ev = calendar->head; ev != NULL; ev = ev->next) {
-			if (occurstoday(today, ev->days)) {
-				if (!lflag)
-					printf("%s", buf1);
-				printf("\t");
-				if (prefix)
-					printf("%s: ", ev->filename);
-				printf("%s\n", ev->name);
-			}
+		outbytes(evs[i]->name, evs[i]->namelen);
+		outbytes("\n", 1);
+	}
+}
+
+/* count trailing zero bits of nonzero word */
+static int
+ctz(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n;
+
+	for (n = 0; !(x & 1); n++)
+		x >>= 1;
+	return n;
+#endif
+}
+
+/* estimate the number of days a year matched by pattern */
+static double
+getfrequency(struct DPattern *d)
+{
+	double n;
+
+	if (getbucket(d) == -1)
+		return 0;
+	n = YEARLEN;
+	if (d->month != 0)
+		n /= NMONTHS;
+	if (d->monthday != 0)
+		n /= YEARLEN / NMONTHS;
+	if (d->weekday != 0)
+		n /= NWDAYS;
+	if (d->monthweek != 0)
+		n *= NWDAYS / (YEARLEN / NMONTHS);
+	return n;
+}
+
+/*
+ * Check whether the events occur so often from first to last that
+ * listing their days through bitmaps costs less than solving their
+ * occurrences.  A bitmap costs about the same for every event and
+ * year, while an occurrence costs a trip through the heap, whose
+ * depth is the log2 of the number of events.  So bitmaps are used
+ * when the occurrences per event and year, as estimated from the
+ * patterns, times that log2, are at least DENSITY.
+ */
+static int
+isdense(struct Calendar *calendar, int first, int last)
+{
+	struct Event *ev;
+	struct Date from, to;
+	double occs, span;
+	size_t i, nevents;
+	int depth;
+
+	/* the bitmaps of a year are computed whole, and the year must not overflow */
+	if (last > INT_MAX - NYDAYS)
+		return 0;
+	juliantodate(&from, first);
+	juliantodate(&to, last);
+	span = ((double)last - first + 1) / YEARLEN;
+	occs = 0;
+	nevents = 0;
+	for (ev = calendar->head; ev != NULL; ev = ev->next) {
+		if (ev->shared)
+			continue;
+		nevents++;
+		for (i = 0; i < ev->ndays; i++) {
+			if (ev->days[i].year == 0)
+				occs += getfrequency(&ev->days[i]) * span;
+			else if (ev->days[i].year >= from.y && ev->days[i].year <= to.y)
+				occs += getfrequency(&ev->days[i]) * MIN(span, 1);
 		}
-		incrdate(today);
 	}
+	for (depth = 0; (nevents >> depth) > 1; depth++)
+		;
+	return occs * depth >= (double)DENSITY * nevents * (to.y - from.y + 1);
 }
 
-/* free events, their name and day patterns */
+/* set the masks of the days of year sharing each field value */
 static void
-freecalendar(struct Calendar *calendar)
+setyearmasks(struct YearMasks *masks, int year)
 {
-	struct Event *e;
+	struct Date day;
+	uint64_t bit;
+	int doy, w;
+
+	memset(masks, 0, sizeof(*masks));
+	(void)mkdate(&day, year, 1, 1);
+	for (doy = 0; ; doy++) {
+		w = doy / WORDBITS;
+		bit = (uint64_t)1 << (doy % WORDBITS);
+		masks->month[0][w] |= bit;
+		masks->month[day.m][w] |= bit;
+		masks->mday[day.d][w] |= bit;
+		masks->wday[day.w + 1][w] |= bit;
+		masks->pmw[day.pmw][w] |= bit;
+		masks->nmw[-day.nmw][w] |= bit;
+		if (day.m == NMONTHS && day.d == NMDAYS)
+			break;
+		incrdate(&day);
+	}
+	memcpy(masks->mday[0], masks->month[0], sizeof(masks->mday[0]));
+	memcpy(masks->wday[0], masks->month[0], sizeof(masks->wday[0]));
+	memcpy(masks->pmw[0], masks->month[0], sizeof(masks->pmw[0]));
+}
+
+/* compute the occurrence bitmaps of the events for year */
+static void
+setyearbits(struct Bitmap *bitmap, int year)
+{
+	struct YearMasks masks;
 	struct DPattern *d;
+	uint64_t *bits, *weeks;
+	size_t i, j;
+	int w;
 
-	while (calendar->head) {
-		e = calendar->head;
-		calendar->head = calendar->head->next;
-		while (e->days) {
-			d = e->days;
-			e->days = e->days->next;
-			free(d);
+	/*
+	 * The days matched by a day pattern are the intersection of the
+	 * days matched by each of its fields; and the days of an event
+	 * are the union of the days of its patterns.
+	 */
+	setyearmasks(&masks, year);
+	memset(bitmap->bits, 0, bitmap->nevents * YEARWORDS * sizeof(*bitmap->bits));
+	for (i = 0; i < bitmap->nevents; i++) {
+		bits = &bitmap->bits[i * YEARWORDS];
+		for (j = 0; j < bitmap->events[i]->ndays; j++) {
+			d = &bitmap->events[i]->days[j];
+			if (getbucket(d) == -1)
+				continue;
+			if (d->year != 0 && d->year != year)
+				continue;
+			weeks = (d->monthweek < 0) ? masks.nmw[-d->monthweek] : masks.pmw[d->monthweek];
+			for (w = 0; w < YEARWORDS; w++) {
+				bits[w] |= masks.month[d->month][w] &
+				           masks.mday[d->monthday][w] &
+				           masks.wday[d->weekday][w] &
+				           weeks[w];
+			}
 		}
-		free(e->name);
-		free(e);
 	}
 }
 
+/* get the bits of word w of bitmap within the days of the year first to last */
+static uint64_t
+getword(uint64_t *bits, int w, int first, int last)
+{
+	uint64_t word;
+
+	word = bits[w];
+	if (w == first / WORDBITS)
+		word &= ~(uint64_t)0 << (first % WORDBITS);
+	if (w == last / WORDBITS)
+		word &= ~(uint64_t)0 >> (WORDBITS - 1 - last % WORDBITS);
+	return word;
+}
+
+/* print events of the days of the year first to last within word w, jan1 being the first day of the year */
+static void
+printword(struct Bitmap *bitmap, struct Heap *shared, struct Event **matches, int jan1, int w, int first, int last, int lflag, int prefix)
+{
+	struct Date day;
+	uint64_t word;
+	size_t count[WORDBITS + 1];
+	size_t i, n;
+	int doy;
+
+	/*
+	 * Count the occurrences of each day of the word, and then sort
+	 * the occurrences by day.  Events are scanned in the order they
+	 * were read, so the events of a day stay in that order.
+	 */
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < bitmap->nevents; i++)
+		for (word = getword(&bitmap->bits[i * YEARWORDS], w, first, last); word != 0; word &= word - 1)
+			count[ctz(word) + 1]++;
+	for (doy = 0; doy < WORDBITS; doy++)
+		count[doy + 1] += count[doy];
+	if (count[WORDBITS] == 0 && !lflag)
+		return;
+	bitmap->sorted = growarray(bitmap->sorted, &bitmap->maxsorted, count[WORDBITS], sizeof(*bitmap->sorted));
+	for (i = 0; i < bitmap->nevents; i++)
+		for (word = getword(&bitmap->bits[i * YEARWORDS], w, first, last); word != 0; word &= word - 1)
+			bitmap->sorted[count[ctz(word)]++] = bitmap->events[i];
+
+	/* after the scatter, count[i] is where the events of the day i+1 of the word begin */
+	i = 0;
+	for (doy = MAX(first, w * WORDBITS); doy <= MIN(last, w * WORDBITS + WORDBITS - 1); doy++) {
+		n = count[doy % WORDBITS] - i;
+		memcpy(matches, &bitmap->sorted[i], n * sizeof(*matches));
+		i = count[doy % WORDBITS];
+		if (n == 0 && !lflag)
+			continue;
+		if (shared->occs != NULL)
+			n = mergeshared(shared, matches, n);
+		juliantodate(&day, jan1 + doy);
+		printday(&day, matches, n, lflag, prefix);
+	}
+}
+
+/* print events from day first to day last, reading them off the occurrence bitmaps */
+static void
+printbitmaps(struct Calendar *calendar, struct Heap *shared, struct Event **matches, int first, int last, int lflag, int prefix)
+{
+	struct Bitmap bitmap;
+	struct Event *ev;
+	struct Date day;
+	int jan1, dec31, w;
+
+	bitmap.events = ecalloc(calendar->nevents + 1, sizeof(*bitmap.events));
+	bitmap.nevents = 0;
+	for (ev = calendar->head; ev != NULL; ev = ev->next)
+		if (!ev->shared)
+			bitmap.events[bitmap.nevents++] = ev;
+	bitmap.bits = ecalloc(bitmap.nevents * YEARWORDS + 1, sizeof(*bitmap.bits));
+	bitmap.sorted = NULL;
+	bitmap.maxsorted = 0;
+	for (;;) {
+		juliantodate(&day, first);
+		day.m = 1;
+		day.d = 1;
+		jan1 = datetojulian(&day);
+		day.m = NMONTHS;
+		day.d = NMDAYS;
+		dec31 = datetojulian(&day);
+		setyearbits(&bitmap, day.y);
+		for (w = (first - jan1) / WORDBITS; w <= (MIN(last, dec31) - jan1) / WORDBITS; w++)
+			printword(&bitmap, shared, matches, jan1, w, first - jan1, MIN(last, dec31) - jan1, lflag, prefix);
+		if (last <= dec31)
+			break;
+		first = dec31 + 1;
+	}
+	free(bitmap.events);
+	free(bitmap.bits);
+	free(bitmap.sorted);
+}
+
+/* print events for today and after days */
+static void
+printcalendar(struct Calendar *calendar, struct Date *today, int after, int lflag, int prefix)
+{
+	struct Index index;
+	struct Heap heap, shared;
+	struct Event **matches;
+	size_t nmatches;
+	int date, last;
+
+	if (after < NMDAYS) {
+		buildindex(calendar, &index);
+		while (after-- >= 0) {
+			nmatches = matchday(&index, today);
+			qsort(index.matches, nmatches, sizeof(*index.matches), compareevent);
+			printday(today, index.matches, nmatches, lflag, prefix);
+			incrdate(today);
+		}
+		free(index.events);
+		free(index.year);
+		free(index.month);
+		free(index.monthday);
+		free(index.weekday);
+		free(index.monthweek);
+		free(index.matches);
+	} else {
+		/* solving is costly, so events with the same day patterns are solved once */
+		shared.occs = NULL;
+		if (dedupevents(calendar) > 0)
+			shared.occs = ecalloc(calendar->nevents + 1, sizeof(*shared.occs));
+		matches = ecalloc(calendar->nevents + 1, sizeof(*matches));
+		date = datetojulian(today);
+		last = (date > INT_MAX - after) ? INT_MAX : date + after;
+		if (isdense(calendar, date, last)) {
+			printbitmaps(calendar, &shared, matches, date, last, lflag, prefix);
+		} else {
+			buildheap(calendar, &heap, date, last);
+			while (date <= last) {
+				/* in short format, days without events print nothing, so skip them */
+				if (!lflag) {
+					if (heap.noccs == 0)
+						break;
+					date = heap.occs[0].date;
+				}
+				nmatches = 0;
+				while (heap.noccs > 0 && heap.occs[0].date == date) {
+					matches[nmatches++] = heap.occs[0].event;
+					advanceheap(&heap, last);
+				}
+				if (shared.occs != NULL)
+					nmatches = mergeshared(&shared, matches, nmatches);
+				juliantodate(today, date);
+				printday(today, matches, nmatches, lflag, prefix);
+				if (date++ == INT_MAX)
+					break;
+			}
+			free(heap.occs);
+		}
+		free(shared.occs);
+		free(matches);
+	}
+}
+
+/* solve the occurrences of event on line within the window of the stream, and keep them */
+static int
+streamline(void *p, const char *line, size_t len, char *filename)
+{
+	struct Stream *stream = p;
+	struct Event tmp, *ev;
+	const char *eol;
+	int date;
+
+	eol = line + len;
+	if ((tmp.ndays = getpatterns(&stream->calendar, line, eol, &line)) == 0)
+		return -1;
+	tmp.days = stream->calendar.patts;
+	ev = NULL;
+	for (date = stream->first; (date = solveevent(&tmp, date)) != NODAY && date <= stream->last; date++) {
+		if (ev == NULL) {
+			ev = arenaalloc(&stream->arena, sizeof(*ev));
+			memset(ev, 0, sizeof(*ev));
+			ev->name = arenastrndup(&stream->arena, line, eol - line);
+			ev->namelen = eol - line;
+			ev->filename = filename;
+			if (stream->nevents == UINT32_MAX)
+				errx(1, "too many events");
+			stream->events = growarray(stream->events, &stream->maxevents, stream->nevents + 1, sizeof(*stream->events));
+			stream->events[stream->nevents++] = ev;
+		}
+		stream->keys = growarray(stream->keys, &stream->maxkeys, stream->nkeys + 1, sizeof(*stream->keys));
+		stream->keys[stream->nkeys++] = (uint64_t)((unsigned)date - (unsigned)stream->first) << 32 | (stream->nevents - 1);
+		if (date == INT_MAX)
+			break;
+	}
+	return 0;
+}
+
+/* compare two occurrence keys of a stream; used by qsort(3) */
+static int
+comparekey(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = *(const uint64_t *)a;
+	y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* get date of occurrence key of stream */
+static int
+keydate(struct Stream *stream, uint64_t key)
+{
+	return (int)((unsigned)stream->first + (unsigned)(key >> 32));
+}
+
+/* print occurrences kept in stream */
+static void
+printstream(struct Stream *stream, int lflag, int prefix)
+{
+	struct Event **evs = NULL;
+	struct Date day;
+	size_t maxevs = 0;
+	size_t i, n;
+	int date;
+
+	qsort(stream->keys, stream->nkeys, sizeof(*stream->keys), comparekey);
+	i = 0;
+	for (date = stream->first; date <= stream->last; date++) {
+		/* in short format, days without events print nothing, so skip to the next one */
+		if (!lflag) {
+			if (i == stream->nkeys)
+				break;
+			date = keydate(stream, stream->keys[i]);
+		}
+		for (n = 0; i + n < stream->nkeys && keydate(stream, stream->keys[i + n]) == date; n++) {
+			evs = growarray(evs, &maxevs, n + 1, sizeof(*evs));
+			evs[n] = stream->events[stream->keys[i + n] & UINT32_MAX];
+		}
+		i += n;
+		juliantodate(&day, date);
+		printday(&day, evs, n, lflag, prefix);
+		if (date == INT_MAX)
+			break;
+	}
+	free(evs);
+}
+
+/* read events from files, one after another; return -1 on error */
+static int
+readfiles(struct Calendar *calendar, struct Input *in, int nfiles, char *files[])
+{
+	int retval = 0;
+	int i;
+
+	if (nfiles == 0)
+		return readfile(parseline, calendar, in, "-");
+	for (i = 0; i < nfiles; i++) {
+		switch (readcalendar(calendar, in, files[i])) {
+		case -1:
+			retval = -1;
+			break;
+		case 1:
+			retval = 1;
+			break;
+		}
+	}
+	return retval;
+}
+
+/* read events from files, one after another, keeping only their occurrences into stream; return -1 on error */
+static int
+streamfiles(struct Stream *stream, int nfiles, char *files[])
+{
+	int retval = 0;
+	int i;
+
+	if (nfiles == 0)
+		return streamfile(streamline, stream, "-");
+	for (i = 0; i < nfiles; i++) {
+		switch (streamfile(streamline, stream, files[i])) {
+		case -1:
+			retval = -1;
+			break;
+		case 1:
+			retval = 1;
+			break;
+		}
+	}
+	return retval;
+}
+
+/* parse the file of the i-th part; run by the workers */
+static void
+parsepart(void *p, size_t i)
+{
+	struct Part *part;
+
+	part = (struct Part *)p + i;
+	if (strcmp(part->filename, "-") != 0) {
+		deferwarnings(&part->warnings);
+		part->retval = readcalendar(&part->calendar, &part->input, part->filename);
+		deferwarnings(NULL);
+	}
+}
+
+/* parse files on up to njobs threads, each into its part; then splice parts into calendar */
+static int
+readparts(struct Calendar *calendar, struct Part *parts, int nfiles, char *files[], int njobs)
+{
+	struct Event *ev;
+	int retval = 0;
+	int i;
+
+	for (i = 0; i < nfiles; i++)
+		parts[i].filename = files[i];
+
+	/* stdin cannot be read concurrently, so it is read here, in order */
+	for (i = 0; i < nfiles; i++) {
+		if (strcmp(files[i], "-") == 0) {
+			deferwarnings(&parts[i].warnings);
+			parts[i].retval = readfile(parseline, &parts[i].calendar, &parts[i].input, files[i]);
+			deferwarnings(NULL);
+		}
+	}
+	runjobs(parsepart, parts, nfiles, njobs);
+
+	/* events are numbered and linked, and warnings printed, as if the files were parsed one after another */
+	for (i = 0; i < nfiles; i++) {
+		printwarnings(&parts[i].warnings);
+		if (parts[i].retval != 0)
+			retval = parts[i].retval;
+		if (parts[i].calendar.head == NULL)
+			continue;
+		for (ev = parts[i].calendar.head; ev != NULL; ev = ev->next)
+			ev->seq = calendar->nevents++;
+		if (calendar->head == NULL)
+			calendar->head = parts[i].calendar.head;
+		if (calendar->tail != NULL)
+			calendar->tail->next = parts[i].calendar.head;
+		calendar->tail = parts[i].calendar.tail;
+	}
+	return retval;
+}
+
+/* free events and their day patterns */
+static void
+freecalendar(struct Calendar *calendar)
+{
+	arenafree(&calendar->arena);
+	free(calendar->patts);
+	calendar->head = calendar->tail = NULL;
+}
+
 /* calendar: print upcoming events */
 int
 main(int argc, char *argv[])
 {
 	static struct Calendar calendar = {
+		.arena = { .blocks = NULL, .used = 0, .size = 0 },
+		.patts = NULL,
+		.maxpatts = 0,
 		.head = NULL,
 		.tail = NULL,
+		.nevents = 0,
 	};
+	static struct Input input = {
+		.arena = { .blocks = NULL, .used = 0, .size = 0 },
+		.maps = NULL,
+	};
+	static struct Stream stream;
+	struct Part *parts = NULL;
 	struct Date today;
 	int after = 1;          /* number of days after today */
+	int njobs = 1;          /* number of threads parsing files */
 	int lflag = 0;          /* whether to print in long format */
+	int sflag = 0;          /* whether to keep only the occurrences of events as they are read */
 	int exitval = 0;
-	int ch;
+	int ch, i;
 
+	profile(NULL);
 	if (gettoday(&today) == -1)
 		err(1, NULL);
+	initnames();
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((njobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		njobs = 1;
+#endif
 	if (today.w == FRIDAY)
 		after = 3;
 	else if (today.w == SATURDAY)
 		after = 2;
-	while ((ch = getopt(argc, argv, "ln:T:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:j:ln:sT:")) != -1) {
 		switch (ch) {
+		case 'c':
+			cachedir = optarg;
+			break;
+		case 'j':
+			njobs = strtonum(optarg, 1, INT_MAX);
+			break;
 		case 'l':
 			lflag = 1;
 			break;
 		case 'n':
 			after = strtonum(optarg, 0, INT_MAX);
 			break;
+		case 's':
+			sflag = 1;
+			break;
 		case 'T':
 			if (strtodate(&today, optarg, NULL) == -1)
 				errx(1, "improper argument date: %s", optarg);
@@ -275,9 +2005,37 @@ main(int argc, char *argv[])
 	}
 	argc -= optind;
 	argv += optind;
-	if (readinput(parseline, &calendar, argc, argv) == -1)
-		exitval = 1;
-	printcalendar(&calendar, &today, after, lflag, argc > 1);
+	if (sflag) {
+		stream.first = datetojulian(&today);
+		stream.last = (stream.first > INT_MAX - after) ? INT_MAX : stream.first + after;
+		if (streamfiles(&stream, argc, argv) == -1)
+			exitval = 1;
+		profile("parse");
+		printstream(&stream, lflag, argc > 1);
+	} else {
+		if (njobs > 1 && argc > 1) {
+			parts = ecalloc(argc, sizeof(*parts));
+			if (readparts(&calendar, parts, argc, argv, njobs) == -1)
+				exitval = 1;
+		} else if (readfiles(&calendar, &input, argc, argv) == -1) {
+			exitval = 1;
+		}
+		profile("parse");
+		printcalendar(&calendar, &today, after, lflag, argc > 1);
+	}
+	outflush();
+	profile("print");
 	freecalendar(&calendar);
+	freecalendar(&stream.calendar);
+	arenafree(&stream.arena);
+	free(stream.events);
+	free(stream.keys);
+	freeinput(&input);
+	for (i = 0; parts != NULL && i < argc; i++) {
+		freecalendar(&parts[i].calendar);
+		freeinput(&parts[i].input);
+	}
+	free(parts);
+	profile("free");
 	return exitval;
 }
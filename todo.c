@@ -1,93 +1,148 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "util.h"
 
 #define DEFDAYS       8                 /* default days til deadline for tasks without deadline */
 #define DEFNICE       3                 /* log2(DEFDAYS) */
-#define NHASH         128               /* size of hash table */
-#define MULTIPLIER    31                /* multiplier for hash table */
+#define MINNICE       (-32)             /* niceness of the most urgent task: -log2(2^31) - 1 */
+#define MAXNICE       (+32)             /* niceness of the least urgent task: log2(2^31) + 1 */
+#define NNICE         (MAXNICE - MINNICE + 1)
+#define NHASH         128               /* initial size of interning table, a power of two */
+#define NMEMO         64                /* size of the table of due dates, a power of two */
 #define TODO          "TODO"
 #define DONE          "DONE"
 #define PROP_DEPS     "deps"
 #define PROP_DUE      "due"
+#define SNAPMAGIC     "todosna1"        /* magic number and version of snapshot files */
+#define MIN(x,y)      ((x)<(y)?(x):(y))
 
 /* collection of tasks */
 struct Agenda {
 	/*
 	 * We collect tasks into five different data structures.
-	 * - (1) A hash table.
-	 * - (2) An unsorted singly linked list.
+	 * - (1) An interning table.
+	 * - (2) Arrays of tasks indexed by their ids.
 	 * - (3) A directed acyclic graph.
-	 * - (4) A topologically sorted doubly linked list.
+	 * - (4) A topologically sorted array of ids.
 	 * - (5) A sorted array.
 	 *
 	 * .The reading phase.
-	 * First, we collect tasks in a hash table (1st data structure)
-	 * and an unsorted singly linked list (2nd).  While we are
-	 * collecting tasks, we get their dependencies and build a
-	 * directed acyclic graph of tasks (3rd).  After reading all
-	 * tasks, we free the hash table (it is only used to get the
-	 * dependencies without having to loop over the unsorted list
-	 * all the time).
+	 * First, we intern the name of each task, and of each task
+	 * it depends on, in an interning table (1st data structure),
+	 * which maps each distinct name in a file to a small integer,
+	 * the id of the task; the task is stored at that index of the
+	 * arrays of tasks (2nd).  While we are collecting tasks, we get
+	 * their dependencies as a list of edges between ids.  After
+	 * reading all tasks, we free the interning table (it is only
+	 * used to get the dependencies without having to loop over the
+	 * array of tasks all the time).
 	 *
 	 * .The sorting phase.
-	 * After collecting tasks, we iterate over the unsorted list of
-	 * tasks and visit each node in the directed graph and create a
-	 * topologically sorted doubly linked list of tasks (4th), that
-	 * will be read in the reverse topological order to compute the
-	 * niceness (anti-urgency) of each task.  Then, we iterate over
-	 * the sorted list to extract those tasks that are not blocked
-	 * by a open (not done) task into an array of tasks (5th) that
+	 * After collecting tasks, we freeze the list of edges into a
+	 * directed acyclic graph of tasks (3rd), in compressed sparse
+	 * row form: the ids of the dependencies of all tasks are laid
+	 * out in one array, those of each task in a row of it, and an
+	 * array of offsets tells where each row begins.  The same is
+	 * done for the dependents of each task.  Then we iterate over
+	 * the array of tasks, from the last id to the first, and visit
+	 * each node in the directed graph to create a topologically
+	 * sorted array of ids (4th), that will be read in the reverse
+	 * topological order to compute the niceness (anti-urgency) of
+	 * each task.  Then, we iterate over the sorted array to extract
+	 * those tasks that are not blocked by a open (not done) task
+	 * into an array of tasks (5th) that
 	 * will be sorted based on the niceness of the tasks.  This
-	 * array contains only those tasks that are unblocked.
+	 * array contains only those tasks that are unblocked.  When
+	 * only the most urgent tasks are to be printed, the array is
+	 * kept as a heap of those tasks, with the least urgent one at
+	 * its root, which is replaced whenever a more urgent task is
+	 * found; so only that many tasks are ever sorted.
 	 *
 	 * .The writing phase.
 	 * Finally, we loop through the array of tasks to print each
 	 * task to the standard output.
 	 */
 
-	struct Task **htab;             /* hash table of tasks */
-	struct Task **array;            /* array of pointers to sorted, unblocked tasks */
-	struct Task *unsort;            /* head of unsorted list of tasks */
-	struct Task *shead, *stail;     /* head and tail of sorted list of tasks */
-	size_t nunblock;                /* number of unblocked tasks */
-	size_t ntasks;                  /* number of tasks */
-};
+	/*
+	 * The interning table is open-addressed and linearly probed;
+	 * it is doubled whenever it gets half full.  Each slot keeps
+	 * the full hash of its name, so a probe only compares names
+	 * when their hashes are equal.  Names are hashed with a key
+	 * chosen at random for each run, so no set of names is known
+	 * to collide.
+	 */
+	struct Slot *htab;              /* interning table of task names */
+	size_t hsize;                   /* number of slots of the interning table */
+	uint64_t hkey[2];               /* key of the hash function */
 
-/* task structure */
-struct Task {
 	/*
-	 * A task maintains some pointers for the data structures where
-	 * tasks are organized.  See the comment at struct Agenda for
-	 * more information.
+	 * Each task is split in two records, stored at the index of its
+	 * id in two arrays.  The fields used while sorting are in struct
+	 * Task, which is small, so the sorting passes go through as few
+	 * cache lines as possible; the strings, only used for looking
+	 * up and printing tasks, are in struct Text.  Ids and indices
+	 * of tasks and edges are 32-bit.
 	 */
-	struct Task *hnext;             /* pointer for hash table linked list */
-	struct Task *unext;             /* pointer for unsorted linked list */
-	struct Task *sprev, *snext;     /* pointer for sorted linked list */
-	struct Edge *deps;              /* linked list of dependency edges */
+	struct Task *tasks;             /* sorting fields of tasks, indexed by id */
+	struct Text *texts;             /* strings of tasks, indexed by id */
+	size_t maxtasks;                /* allocated size of the arrays of tasks */
+	struct Edge *edges;             /* dependencies, as they are read */
+	size_t nedges;                  /* number of dependencies */
+	size_t maxedges;                /* allocated size of the array of edges */
 
 	/*
-	 * Tasks are first read from the files (or stdin) and collected.
-	 * We use a hash table to lookup tasks or create them.  When a
-	 * task is read, it is created and initialized (its init field
-	 * is set as 1).  When a task is only mentioned as a dependency
-	 * of another task, its init field is zero.
+	 * The dependencies of task i are deps[depoff[i]] up to (but
+	 * not including) deps[depoff[i + 1]], most recently read first;
+	 * its dependents are rdeps[rdepoff[i]] up to rdeps[rdepoff[i + 1]].
 	 */
-	int init;                       /* whether task was initialized */
+	uint32_t *depoff, *deps;        /* graph of dependencies */
+	uint32_t *rdepoff, *rdeps;      /* graph of dependents */
+	uint32_t *order;                /* ids of tasks in topological order */
+	size_t norder;                  /* number of tasks sorted so far */
+	uint32_t *array;                /* ids of sorted, unblocked tasks */
+	size_t nunblock;                /* number of unblocked tasks */
+	size_t maxunblock;              /* maximum number of unblocked tasks to keep */
+	size_t ntasks;                  /* number of tasks */
+	size_t nwarns;                  /* number of warnings about properties */
+	char *error;                    /* why the tasks cannot be sorted, if they cannot */
+	struct Token *props;            /* property words of the line being parsed */
+	size_t maxprops;                /* allocated size of the array of property words */
 
+	/*
+	 * Task files repeat the same few due dates over and over, so
+	 * the last date parsed into each slot of this direct-mapped
+	 * table is kept, keyed on its string in the input.
+	 */
+	struct Memo {
+		const char *s;          /* due date as it is in the input */
+		size_t len;             /* its length */
+		int due;                /* it in unix julian day */
+	} memo[NMEMO];
+};
+
+/* fields of a task used for sorting */
+struct Task {
 	/*
 	 * The niceness of a task is its anti-urgency.  The nicer a task
 	 * is, the less urgent it is.   The nice field is computed after
-	 * generating a topologically sorted doubly linked list of
-	 * tasks.  We need this topological order because the niceness
-	 * of a task depends on the niceness of the tasks that depends
-	 * on it.
+	 * generating a topologically sorted array of tasks.  We need
+	 * this topological order because the niceness of a task depends
+	 * on the niceness of the tasks that depends on it.
 	 *
 	 * The niceness of a task is the log2 of the days from now until
 	 * its deadline, minus the priority.
@@ -100,12 +155,6 @@ struct Task {
 	 */
 	int nice;                       /* task niceness; the lower the more urgent */
 
-	/*
-	 * For topologically sorting the tasks, we need to know whether
-	 * a task was visited.
-	 */
-	int visited;                    /* whether node was visited while sorting */
-
 	/*
 	 * The deadline of the task is represented by the date in UNIX
 	 * julian day (number of days since UNIX epoch).  The number
@@ -121,103 +170,340 @@ struct Task {
 	 */
 	int due;                        /* due date in UNIX julian day */
 	int ndays;                      /* due date - today */
-	int pri;                        /* priority */
-	int done;                       /* whether task is marked as done */
 
 	/*
-	 * Tasks are identified by the following fields.
+	 * For topologically sorting the tasks, we need to know whether
+	 * a task was visited.  Its position in the topological order
+	 * breaks ties between tasks as nice as each other.
+	 */
+	uint32_t pos;                   /* position in topological order */
+	signed char pri;                /* priority */
+	unsigned char done;             /* whether task is marked as done */
+	unsigned char visited;          /* whether node was visited while sorting */
+
+	/*
+	 * Tasks are first read from the files (or stdin) and collected.
+	 * We use an interning table to lookup tasks or create them.
+	 * When a task is read, it is created and initialized (its init
+	 * field is set as 1).  When a task is only mentioned as a
+	 * dependency of another task, its init field is zero.
 	 */
-	char *name;                     /* task name */
+	unsigned char init;             /* whether task was initialized */
+};
+
+/* strings of a task */
+struct Text {
+	/*
+	 * Tasks are identified by the following fields.  The strings
+	 * of a task are not copied, but point into the input lines;
+	 * so they are not nul-terminated, and come with their length.
+	 * The name is interned: it points to its first occurrence in
+	 * the file, and two tasks are the same if they have the same
+	 * id.  There is one filename string per file, so filenames are
+	 * compared as pointers.
+	 */
+	const char *name;               /* task name */
 	const char *filename;           /* file task came from */
 
 	/*
 	 * The following fields are only used for printing the task.
 	 */
-	char *date;                     /* due date, in format YYYY-MM-DD*/
-	char *desc;                     /* task description */
+	const char *date;               /* due date, in format YYYY-MM-DD*/
+	const char *desc;               /* task description */
+	uint32_t namelen;               /* length of task name */
+	uint32_t datelen;               /* length of due date */
+	uint32_t desclen;               /* length of task description */
+};
+
+/* slot of the interning table */
+struct Slot {
+	uint64_t hash;                  /* hash of name and filename */
+	uint32_t id;                    /* id of task plus one; zero if slot is empty */
 };
 
 /* dependency link for the directed graph */
 struct Edge {
-	struct Edge *next;              /* next edge on linked list */
-	struct Task *to;                /* task the edge links to */
+	uint32_t from;                  /* id of the task the edge links from */
+	uint32_t to;                    /* id of the task the edge links to */
+};
+
+/* property word of a line, as a view into it */
+struct Token {
+	const char *name;               /* beginning of the word */
+	const char *colon;              /* first colon of the word, ending the property name */
+	const char *end;                /* end of the word */
+};
+
+/* property of a task, and the function setting it from its value */
+struct Property {
+	const char *name;
+	size_t len;
+	void (*fun)(struct Agenda *, uint32_t, char *, const char *, const char *);
+};
+
+/* entry of the stack of tasks being visited while sorting */
+struct Frame {
+	uint32_t id;                    /* id of task being visited */
+	uint32_t dep;                   /* index in deps of next dependency to visit */
+};
+
+/* header of todo snapshot file */
+struct SnapHeader {
+	/*
+	 * With -c, the tasks read from each file are saved into a
+	 * snapshot file keyed by the real path of the input file (see
+	 * cachepath()), whose identity is checked in the header,
+	 * together with their graphs and their topological order, which
+	 * do not depend on the current date.  The header is followed by
+	 * an array of tasks, the offsets and ids of the graph of
+	 * dependencies, those of the graph of dependents, and the ids
+	 * of tasks in topological order.  The strings of tasks are not
+	 * copied into the snapshot, but kept as offsets into the input
+	 * file; so the snapshot is only used if the input file still
+	 * has the same contents.  Files with warnings are not saved, so
+	 * their warnings are printed again on each run; their stale
+	 * snapshot, if any, is removed.
+	 */
+	char magic[8];
+	uint64_t dev;                   /* device of input file */
+	uint64_t ino;                   /* inode of input file */
+	uint64_t size;                  /* size of input file */
+	int64_t mtime;                  /* modification time, seconds */
+	int64_t mtimensec;              /* modification time, nanoseconds */
+	uint64_t hash;                  /* hash of contents of input file */
+	uint64_t ntasks;                /* number of tasks */
+	uint64_t nedges;                /* number of dependencies */
+	uint64_t datahash;              /* hash of the rest of the snapshot file */
+};
+
+/* task saved into a snapshot */
+struct SnapTask {
+	uint64_t nameoff;               /* offset of task name into input file */
+	uint64_t descoff;               /* offset of task description into input file */
+	uint64_t dateoff;               /* offset of due date into input file */
+	uint32_t namelen;               /* length of task name */
+	uint32_t desclen;               /* length of task description */
+	uint32_t datelen;               /* length of due date; zero if there is none */
+	int32_t due;                    /* due date in UNIX julian day */
+	int8_t pri;                     /* priority */
+	uint8_t done;                   /* whether task is marked as done */
+	uint8_t pad[6];
+};
+
+/* snapshot built while a file is read */
+struct SnapBuild {
+	struct Agenda *agenda;          /* agenda the file is read into */
+	const char *buf;                /* memory-mapped input file */
+	size_t size;                    /* size of input file */
+	const char *last;               /* copy of the last line, if not in the mapping */
+	size_t lastlen;                 /* length of the last line */
+};
+
+/* tasks of a file, read and sorted on their own */
+struct Part {
+	struct Agenda agenda;           /* tasks of the file */
+	struct Input input;             /* lines of the file */
+	char *filename;
+	int retval;                     /* what readfile() returned */
+	int today;                      /* today in UNIX julian day */
+	int dflag;                      /* whether tasks with passed deadline are done */
+	struct Warnings warnings;       /* warnings about the file, printed once all files are read */
 };
 
+static char *cachedir = NULL;           /* directory of snapshot files; NULL for no snapshots */
+
+/* key for the hash of snapshot files; their contents are not secret */
+static const uint64_t snapkey[2] = { 0x746f646f736e6170ULL, 0 };
+
 /* show usage and exit */
 static void
 usage(void)
 {
-	(void)fprintf(stderr, "usage: todo [-dl] [-T yyyy-mm-dd] [file...]\n");
+	(void)fprintf(stderr, "usage: todo [-dl] [-c cachedir] [-j njobs] [-n count] [-o offset] [-T yyyy-mm-dd] [file...]\n");
 	exit(1);
 }
 
-/* compute hash value of string */
-static size_t
-hash(const char *s)
+/* choose key of the hash function from whatever varies between runs */
+static void
+seedhash(struct Agenda *agenda)
 {
-	size_t h;
-	unsigned char *p;
+	static const uint64_t key[2] = { 0x746f646f68617368ULL, 0 };
+	struct timespec ts;
+	uint64_t seed[4];
 
-	h = 0;
-	for (p = (unsigned char *)s; *p != '\0'; p++)
-		h = MULTIPLIER * h + *p;
-	return h % NHASH;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	seed[0] = ts.tv_sec;
+	seed[1] = ts.tv_nsec;
+	seed[2] = getpid();
+	seed[3] = (uintptr_t)&ts ^ (uintptr_t)seedhash;
+	agenda->hkey[0] = siphash(seed, sizeof(seed), key);
+	seed[0] = agenda->hkey[0];
+	agenda->hkey[1] = siphash(seed, sizeof(seed), key);
 }
 
-/* find name in agenda, creating if does not exist */
-static struct Task *
-lookupcreate(struct Agenda *agenda, const char *filename, const char *name)
+/* compute hash value of the len bytes at s, from file filename */
+static uint64_t
+hash(struct Agenda *agenda, const char *filename, const char *s, size_t len)
 {
-	struct Task *task;
-	size_t h;
-
-	h = hash(name);
-	for (task = agenda->htab[h]; task != NULL; task = task->hnext)
-		if (strcmp(name, task->name) == 0 && task->filename == filename)
-			return task;
-	task = emalloc(sizeof(*task));
-	task->name = estrdup(name);
-	task->filename = filename;
-	task->hnext = agenda->htab[h];
-	task->unext = agenda->unsort;
-	agenda->htab[h] = task;
-	agenda->unsort = task;
-	agenda->ntasks++;
-	return task;
-}
-
-/* add dependencies to task; we change s */
+	uint64_t key[2];
+
+	key[0] = agenda->hkey[0] ^ (uintptr_t)filename;
+	key[1] = agenda->hkey[1];
+	return siphash(s, len, key);
+}
+
+/* set agenda up for reading tasks, keeping up to maxunblock unblocked tasks */
 static void
-adddeps(struct Agenda *agenda, struct Task *task, char *filename, char *s)
+initagenda(struct Agenda *agenda, size_t maxunblock)
 {
-	struct Task *tmp;
-	struct Edge *edge;
-	char *t;
+	memset(agenda, 0, sizeof(*agenda));
+	agenda->htab = ecalloc(NHASH, sizeof(*agenda->htab));
+	agenda->hsize = NHASH;
+	agenda->maxunblock = maxunblock;
+	seedhash(agenda);
+}
+
+/* double the number of slots of the interning table */
+static void
+growhash(struct Agenda *agenda)
+{
+	struct Slot *htab;
+	size_t hsize, i, b;
+
+	hsize = 2 * agenda->hsize;
+	htab = ecalloc(hsize, sizeof(*htab));
+	for (i = 0; i < agenda->hsize; i++) {
+		if (agenda->htab[i].id == 0)
+			continue;
+		b = agenda->htab[i].hash & (hsize - 1);
+		while (htab[b].id != 0)
+			b = (b + 1) & (hsize - 1);
+		htab[b] = agenda->htab[i];
+	}
+	free(agenda->htab);
+	agenda->htab = htab;
+	agenda->hsize = hsize;
+}
+
+/* get id of name of length len in file filename, creating a task for it if it is new */
+static uint32_t
+intern(struct Agenda *agenda, const char *filename, const char *name, size_t len)
+{
+	struct Text *text;
+	struct Slot *slot;
+	uint64_t h;
+	size_t b;
+	uint32_t id;
+
+	if (2 * agenda->ntasks >= agenda->hsize)
+		growhash(agenda);
+	h = hash(agenda, filename, name, len);
+	for (b = h & (agenda->hsize - 1); agenda->htab[b].id != 0; b = (b + 1) & (agenda->hsize - 1)) {
+		slot = &agenda->htab[b];
+		if (slot->hash != h)
+			continue;
+		text = &agenda->texts[slot->id - 1];
+		if (text->namelen == len && text->filename == filename &&
+		    memcmp(name, text->name, len) == 0)
+			return slot->id - 1;
+	}
+	if (agenda->ntasks >= UINT32_MAX - 1 || len > UINT32_MAX)
+		errx(1, "%s: too many tasks", filename);
+	if (agenda->ntasks == agenda->maxtasks) {
+		agenda->maxtasks = (agenda->maxtasks > 0) ? 2 * agenda->maxtasks : NHASH;
+		agenda->tasks = ereallocarray(agenda->tasks, agenda->maxtasks, sizeof(*agenda->tasks));
+		agenda->texts = ereallocarray(agenda->texts, agenda->maxtasks, sizeof(*agenda->texts));
+	}
+	id = agenda->ntasks++;
+	memset(&agenda->tasks[id], 0, sizeof(agenda->tasks[id]));
+	memset(&agenda->texts[id], 0, sizeof(agenda->texts[id]));
+	agenda->texts[id].name = name;
+	agenda->texts[id].namelen = len;
+	agenda->texts[id].filename = filename;
+	agenda->htab[b].hash = h;
+	agenda->htab[b].id = id + 1;
+	return id;
+}
+
+/* add dependencies in the comma-separated list from s to end to task from */
+static void
+adddeps(struct Agenda *agenda, uint32_t from, char *filename, const char *s, const char *end)
+{
+	uint32_t id;
+	const char *t;
+
+	for (; s < end; s = t + 1) {
+		if ((t = memchr(s, ',', end - s)) == NULL)
+			t = end;
+		if (t == s)
+			continue;
+		id = intern(agenda, filename, s, t - s);
+		if (agenda->nedges >= UINT32_MAX - 1)
+			errx(1, "%s: too many dependencies", filename);
+		if (agenda->nedges == agenda->maxedges) {
+			agenda->maxedges = (agenda->maxedges > 0) ? 2 * agenda->maxedges : NHASH;
+			agenda->edges = ereallocarray(agenda->edges, agenda->maxedges, sizeof(*agenda->edges));
+		}
+		agenda->edges[agenda->nedges].from = from;
+		agenda->edges[agenda->nedges].to = id;
+		agenda->nedges++;
+	}
+}
+
+/* set due date of task id to the date from s to end */
+static void
+setdue(struct Agenda *agenda, uint32_t id, char *filename, const char *s, const char *end)
+{
+	struct Memo *memo;
+	size_t len, h, i;
+	int due;
 
-	for (t = strtok(s, ","); t != NULL; t = strtok(NULL, ",")) {
-		tmp = lookupcreate(agenda, filename, t);
-		edge = emalloc(sizeof(*edge));
-		edge->next = task->deps;
-		edge->to = tmp;
-		task->deps = edge;
+	(void)filename;
+	len = end - s;
+	for (h = i = 0; i < len; i++)
+		h = h * 31 + (unsigned char)s[i];
+	memo = &agenda->memo[h & (NMEMO - 1)];
+	if (memo->s != NULL && memo->len == len && memcmp(memo->s, s, len) == 0) {
+		due = memo->due;
+	} else if (strtojulian(&due, s, len) == 0) {
+		memo->s = s;
+		memo->len = len;
+		memo->due = due;
+	} else {
+		warnmsg("improper time format: %.*s", (int)len, s);
+		agenda->nwarns++;
+		return;
 	}
+	agenda->texts[id].date = s;
+	agenda->texts[id].datelen = len;
+	agenda->tasks[id].due = due;
 }
 
-/* parse line for a new task and add it into agenda; we change line; return -1 on error */
+static const struct Property properties[] = {
+	{ PROP_DEPS,    sizeof(PROP_DEPS) - 1,  adddeps },
+	{ PROP_DUE,     sizeof(PROP_DUE) - 1,   setdue },
+};
+
+/* parse line of length len for a new task and add it into agenda; return -1 on error */
 static int
-parseline(void *p, char *line, char *filename)
+parseline(void *p, const char *line, size_t len, char *filename)
 {
 	struct Agenda *agenda = p;
-	struct Date d;
 	struct Task *task;
-	size_t len;
+	struct Text *text;
+	struct Token *tok;
+	size_t namelen, nprops, i;
+	uint32_t id;
 	int done;
-	char *name, *prop, *val;
-	char *s, *end, *colon;
+	const char *name, *val, *valend, *eol;
+	const char *s, *word, *colon, *cut;
 	int pri;
 
+	/* the line is not changed, so we keep track of where it ends */
+	eol = line + len;
+
 	/* get status */
-	while (isspace(*(unsigned char *)line))
+	while (line < eol && isspace(*(unsigned char *)line))
 		line++;
 	done = 0;
 	if (strncmp(line, TODO, sizeof(TODO) - 1) == 0) {
@@ -228,23 +514,24 @@ parseline(void *p, char *line, char *filename)
 	}
 
 	/* get name and create task */
-	while (isspace(*(unsigned char *)line))
+	while (line < eol && isspace(*(unsigned char *)line))
 		line++;
 	name = NULL;
-	for (s = line; *s != '\0' && !isspace(*(unsigned char *)s); s++) {
+	namelen = 0;
+	for (s = line; s < eol && !isspace(*(unsigned char *)s); s++) {
 		if (*s == ':') {
 			name = line;
-			*s = '\0';
+			namelen = s - line;
 			line = s + 1;
 			break;
 		}
 	}
 	if (name == NULL)
 		return - 1;
-	task = lookupcreate(agenda, filename, name);
+	id = intern(agenda, filename, name, namelen);
 
 	/* get priority */
-	while (isspace(*(unsigned char *)line))
+	while (line < eol && isspace(*(unsigned char *)line))
 		line++;
 	pri = 0;
 	if (line[0] == '(' && line[1] >= 'A' && line[1] <= 'C' && line[2] == ')') {
@@ -262,51 +549,70 @@ parseline(void *p, char *line, char *filename)
 		line += 3;
 	}
 
-	/* get properties */
-	while (isspace(*(unsigned char *)line))
+	/*
+	 * Split the rest of the line into words.  The properties are
+	 * the words with a colon at the end of the line; a word with no
+	 * colon is part of the description, which ends with it, so the
+	 * properties seen before it are dropped.
+	 */
+	while (line < eol && isspace(*(unsigned char *)line))
 		line++;
-	len = strlen(line);
-	for (s = &line[len - 1]; s >= line; s--) {
+	cut = line;
+	nprops = 0;
+	for (s = line; s < eol; ) {
+		if (isspace(*(unsigned char *)s)) {
+			s++;
+			continue;
+		}
+		word = s;
 		colon = NULL;
-		while (s >= line && isspace(*(unsigned char *)s))
-			s--;
-		end = s + 1;
-		while (s >= line && !isspace(*(unsigned char *)s)) {
-			if (*s == ':') {
+		for (; s < eol && !isspace(*(unsigned char *)s); s++)
+			if (*s == ':' && colon == NULL)
 				colon = s;
-				*colon = '\0';
-			}
-			s--;
+		if (colon == NULL) {
+			cut = s;
+			nprops = 0;
+			continue;
 		}
-		if (colon) {
-			*s = '\0';
-			*end = '\0';
-			prop = s + 1;
-			val = colon + 1;
-			if (strcmp(prop, PROP_DUE) == 0) {
-				if (strtodate(&d, val, NULL) == -1) {
-					warnx("improper time format: %s", val);
-				} else {
-					task->date = estrdup(val);
-					task->due = datetojulian(&d);
-				}
-			} else if (strcmp(prop, PROP_DEPS) == 0) {
-				adddeps(agenda, task, filename, val);
-			} else {
-				warnx("unknown property \"%s\"", prop);
-			}
-		} else {
-			break;
+		if (nprops == agenda->maxprops) {
+			agenda->maxprops = (agenda->maxprops > 0) ? 2 * agenda->maxprops : 8;
+			agenda->props = ereallocarray(agenda->props, agenda->maxprops, sizeof(*agenda->props));
 		}
+		agenda->props[nprops].name = word;
+		agenda->props[nprops].colon = colon;
+		agenda->props[nprops].end = s;
+		nprops++;
 	}
 
-	/* get description */
-	len = strlen(line);
-	for (s = &line[len - 1]; isspace(*(unsigned char *)s) && s >= line; s--)
-		*s = '\0';
+	/*
+	 * Set properties, from the last one to the first, so the first
+	 * due date wins.  The property value goes up to the next colon.
+	 * Getting dependencies may create tasks and move the arrays of
+	 * tasks, so the task is always got from its id.
+	 */
+	while (nprops-- > 0) {
+		tok = &agenda->props[nprops];
+		val = tok->colon + 1;
+		if ((valend = memchr(val, ':', tok->end - val)) == NULL)
+			valend = tok->end;
+		for (i = 0; i < sizeof(properties) / sizeof(*properties); i++) {
+			if ((size_t)(tok->colon - tok->name) == properties[i].len &&
+			    memcmp(tok->name, properties[i].name, properties[i].len) == 0) {
+				(*properties[i].fun)(agenda, id, filename, val, valend);
+				break;
+			}
+		}
+		if (i == sizeof(properties) / sizeof(*properties)) {
+			warnmsg("unknown property \"%.*s\"", (int)(tok->colon - tok->name), tok->name);
+			agenda->nwarns++;
+		}
+	}
 
-	free(task->desc);               /* in case we are overriding an existing task */
-	task->desc = estrdup(line);
+	/* get description, which ends with its last word */
+	task = &agenda->tasks[id];
+	text = &agenda->texts[id];
+	text->desc = line;
+	text->desclen = MIN((size_t)(cut - line), UINT32_MAX);
 	task->init = 1;
 	task->pri = pri;
 	task->visited = 0;
@@ -315,26 +621,131 @@ parseline(void *p, char *line, char *filename)
 	return 0;
 }
 
-/* visit task and their dependencies */
+/* build the graphs of dependencies and dependents from the list of edges */
 static void
-visittask(struct Agenda *agenda, struct Task *task)
+mkgraph(struct Agenda *agenda)
 {
 	struct Edge *edge;
+	size_t i;
 
-	if (task->visited > 1)
-		return;
-	if (task->visited == 1)
-		errx(1, "%s: cyclic dependency between tasks", task->filename);
-	task->visited = 1;
-	for (edge = task->deps; edge != NULL; edge = edge->next)
-		visittask(agenda, edge->to);
-	task->visited = 2;
-	if (agenda->shead == NULL)
-		agenda->shead = task;
-	if (agenda->stail != NULL)
-		agenda->stail->snext = task;
-	task->sprev = agenda->stail;
-	agenda->stail = task;
+	agenda->depoff = ecalloc(agenda->ntasks + 1, sizeof(*agenda->depoff));
+	agenda->rdepoff = ecalloc(agenda->ntasks + 1, sizeof(*agenda->rdepoff));
+	agenda->deps = ecalloc(agenda->nedges + 1, sizeof(*agenda->deps));
+	agenda->rdeps = ecalloc(agenda->nedges + 1, sizeof(*agenda->rdeps));
+
+	/* count edges from and to each task, and sum the counts up to the end of each row */
+	for (i = 0; i < agenda->nedges; i++) {
+		agenda->depoff[agenda->edges[i].from]++;
+		agenda->rdepoff[agenda->edges[i].to]++;
+	}
+	for (i = 1; i <= agenda->ntasks; i++) {
+		agenda->depoff[i] += agenda->depoff[i - 1];
+		agenda->rdepoff[i] += agenda->rdepoff[i - 1];
+	}
+
+	/*
+	 * Fill each row from its end, moving its offset back to where
+	 * the row begins.  The first edge read is put last, so that the
+	 * dependencies are visited in the same order as they were when
+	 * each task had a linked list of them, most recent first.
+	 */
+	for (i = 0; i < agenda->nedges; i++) {
+		edge = &agenda->edges[i];
+		agenda->deps[--agenda->depoff[edge->from]] = edge->to;
+		agenda->rdeps[--agenda->rdepoff[edge->to]] = edge->from;
+	}
+	free(agenda->edges);
+	agenda->edges = NULL;
+}
+
+/* set why the tasks of agenda cannot be sorted to the message from fmt */
+static void
+failsort(struct Agenda *agenda, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		err(1, "vsnprintf");
+	agenda->error = emalloc(n + 1);
+	va_start(ap, fmt);
+	(void)vsnprintf(agenda->error, n + 1, fmt, ap);
+	va_end(ap);
+}
+
+/* report the cycle of dependencies from task id to the top of the stack of n frames */
+static void
+cycle(struct Agenda *agenda, struct Frame *stack, size_t n, uint32_t id)
+{
+	struct Text *text;
+	size_t i, j, size;
+	char *path, *s;
+
+	for (i = n - 1; stack[i].id != id; i--)
+		;
+	size = agenda->texts[id].namelen + 1;
+	for (j = i; j < n; j++)
+		size += agenda->texts[stack[j].id].namelen + 4;
+	s = path = emalloc(size);
+	for (j = i; j < n; j++) {
+		text = &agenda->texts[stack[j].id];
+		memcpy(s, text->name, text->namelen);
+		s += text->namelen;
+		memcpy(s, " -> ", 4);
+		s += 4;
+	}
+	text = &agenda->texts[id];
+	memcpy(s, text->name, text->namelen);
+	s[text->namelen] = '\0';
+	failsort(agenda, "%s: cyclic dependency between tasks: %s", text->filename, path);
+	free(path);
+}
+
+/*
+ * Visit task and their dependencies, depth first, appending each task
+ * to the sorted array after its dependencies.  The tasks being visited
+ * are kept in an explicit stack rather than in recursive calls, so a
+ * long chain of dependencies cannot overflow the call stack; the stack
+ * has room for all tasks, as a task is in it at most once.  Return -1
+ * if there is a cyclic dependency.
+ */
+static int
+visittask(struct Agenda *agenda, struct Frame *stack, uint32_t id)
+{
+	struct Frame *frame;
+	struct Task *to;
+	size_t n;
+
+	agenda->tasks[id].visited = 1;
+	stack[0].id = id;
+	stack[0].dep = agenda->depoff[id];
+	n = 1;
+	while (n > 0) {
+		frame = &stack[n - 1];
+		if (frame->dep == agenda->depoff[frame->id + 1]) {
+			agenda->tasks[frame->id].visited = 2;
+			agenda->tasks[frame->id].pos = agenda->norder;
+			agenda->order[agenda->norder++] = frame->id;
+			n--;
+			continue;
+		}
+		id = agenda->deps[frame->dep++];
+		to = &agenda->tasks[id];
+		if (to->visited > 1)
+			continue;
+		if (to->visited == 1) {
+			cycle(agenda, stack, n, id);
+			return -1;
+		}
+		to->visited = 1;
+		stack[n].id = id;
+		stack[n].dep = agenda->depoff[id];
+		n++;
+	}
+	return 0;
 }
 
 /* compute niceness as log2(due - today - sub) - pri */
@@ -357,160 +768,662 @@ calcnice(int ndays, int pri)
 	return nice - pri;
 }
 
-/* compare the niceness of two tasks; used by qsort(3) */
+/* compare the niceness of tasks a and b, then their topological order */
 static int
-comparetask(const void *a, const void *b)
+comparetask(const struct Task *tasks, uint32_t a, uint32_t b)
 {
-	struct Task *taska, *taskb;
-
-	taska = *(struct Task **)a;
-	taskb = *(struct Task **)b;
-	if (taska->nice < taskb->nice)
+	if (tasks[a].nice < tasks[b].nice)
+		return -1;
+	if (tasks[a].nice > tasks[b].nice)
+		return +1;
+	if (tasks[a].pos < tasks[b].pos)
 		return -1;
-	if (taska->nice > taskb->nice)
+	if (tasks[a].pos > tasks[b].pos)
 		return +1;
 	return 0;
 }
 
-/* compute task niceness; create array of unblocked tasks; and sort it based on niceness */
+/* move task at i down the heap of n tasks, below the less urgent of its children */
+static void
+siftdown(const struct Task *tasks, uint32_t *heap, size_t n, size_t i)
+{
+	size_t child;
+	uint32_t id;
+
+	id = heap[i];
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && comparetask(tasks, heap[child + 1], heap[child]) > 0)
+			child++;
+		if (comparetask(tasks, heap[child], id) <= 0)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = id;
+}
+
+/* sort heap of n tasks in place, from the most urgent to the least urgent */
+static void
+sortheap(const struct Task *tasks, uint32_t *heap, size_t n)
+{
+	uint32_t id;
+
+	while (n-- > 1) {
+		id = heap[0];
+		heap[0] = heap[n];
+		heap[n] = id;
+		siftdown(tasks, heap, n, 0);
+	}
+}
+
+/*
+ * Sort the array of unblocked tasks, which are in topological order,
+ * by niceness.  As niceness only takes a few values, the tasks are
+ * counted by niceness and then placed each after those less nice, in
+ * the order they are, so tasks as nice as each other are kept in
+ * topological order.
+ */
+static void
+countsort(struct Agenda *agenda)
+{
+	uint32_t *sorted;
+	size_t count[NNICE + 1];
+	size_t i;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < agenda->nunblock; i++)
+		count[agenda->tasks[agenda->array[i]].nice - MINNICE + 1]++;
+	for (i = 1; i < NNICE; i++)
+		count[i] += count[i - 1];
+	sorted = ecalloc(agenda->nunblock + 1, sizeof(*sorted));
+	for (i = 0; i < agenda->nunblock; i++)
+		sorted[count[agenda->tasks[agenda->array[i]].nice - MINNICE]++] = agenda->array[i];
+	free(agenda->array);
+	agenda->array = sorted;
+}
+
+/* add unblocked task to the array, keeping only the agenda->maxunblock most urgent ones */
 static void
+addunblock(struct Agenda *agenda, uint32_t id)
+{
+	size_t i;
+
+	if (agenda->nunblock < agenda->maxunblock) {
+		agenda->array[agenda->nunblock++] = id;
+		if (agenda->nunblock == agenda->maxunblock && agenda->maxunblock < agenda->ntasks)
+			for (i = agenda->nunblock / 2; i-- > 0; )
+				siftdown(agenda->tasks, agenda->array, agenda->nunblock, i);
+	} else if (agenda->nunblock > 0 && comparetask(agenda->tasks, id, agenda->array[0]) < 0) {
+		agenda->array[0] = id;
+		siftdown(agenda->tasks, agenda->array, agenda->nunblock, 0);
+	}
+}
+
+/* build graph of tasks and sort it topologically (also check if task was not initialized); return -1 on error */
+static int
+toposort(struct Agenda *agenda)
+{
+	struct Frame *stack;
+	size_t i;
+
+	mkgraph(agenda);
+	stack = ecalloc(agenda->ntasks, sizeof(*stack));
+	agenda->order = ecalloc(agenda->ntasks + 1, sizeof(*agenda->order));
+	for (i = agenda->ntasks; i-- > 0; ) {
+		if (!agenda->tasks[i].init) {
+			failsort(agenda, "task \"%.*s\" mentioned but not defined",
+			         (int)agenda->texts[i].namelen, agenda->texts[i].name);
+			break;
+		}
+		if (!agenda->tasks[i].visited && visittask(agenda, stack, i) == -1) {
+			break;
+		}
+	}
+	free(stack);
+	return (agenda->error != NULL) ? -1 : 0;
+}
+
+/* compute task niceness; create array of unblocked tasks; and sort it based on niceness; return -1 on error */
+static int
 sorttasks(struct Agenda *agenda, int today, int dflag)
 {
-	struct Task *task;
-	struct Edge *edge;
+	struct Task *task, *dep;
+	size_t i, j;
+	uint32_t id;
 	int cont;
 
-	/* first pass: topological sort (also compute ndays and check if task was not initialized) */
-	for (task = agenda->unsort; task != NULL; task = task->unext) {
-		if (!task->init) {
-			errx(1, "task \"%s\" mentioned but not defined", task->name);
-		}
+	/* tasks loaded from a snapshot are already sorted topologically */
+	if (agenda->error != NULL || (agenda->order == NULL && toposort(agenda) == -1))
+		return -1;
+
+	/* first pass: compute ndays (and mark tasks with passed deadline as done, if asked to) */
+	for (i = 0; i < agenda->ntasks; i++) {
+		task = &agenda->tasks[i];
 		if ((task->ndays = (task->due > 0) ? task->due - today : DEFDAYS) < 0 && dflag) {
 			task->done = 1;
 		}
-		if (!task->visited) {
-			visittask(agenda, task);
-		}
 	}
 
-	/* second pass: compute nicenesses; and reset priority and ndays of dependencies if necessary */
-	for (task = agenda->stail; task != NULL; task = task->sprev) {
-		task->nice = calcnice(task->ndays, task->pri);
-		for (edge = task->deps; edge != NULL; edge = edge->next) {
-			if (task->due != 0) {
-				if (edge->to->due == 0 || task->ndays <= edge->to->ndays) {
-					edge->to->ndays = task->ndays - 1;
+	/*
+	 * Second pass: compute nicenesses, in reverse topological
+	 * order.  Before computing the niceness of a task, reset its
+	 * priority and ndays from those of its dependents, which were
+	 * all computed before.
+	 */
+	for (i = agenda->norder; i-- > 0; ) {
+		id = agenda->order[i];
+		task = &agenda->tasks[id];
+		for (j = agenda->rdepoff[id]; j < agenda->rdepoff[id + 1]; j++) {
+			dep = &agenda->tasks[agenda->rdeps[j]];
+			if (dep->due != 0) {
+				if (task->due == 0 || dep->ndays <= task->ndays) {
+					task->ndays = dep->ndays - 1;
 				}
-				edge->to->due = 1;
+				task->due = 1;
 			}
-			if (task->pri > edge->to->pri) {
-				edge->to->pri = task->pri;
+			if (dep->pri > task->pri) {
+				task->pri = dep->pri;
 			}
 		}
+		task->nice = calcnice(task->ndays, task->pri);
 	}
 
 	/* third pass: create array of unblocked tasks */
-	agenda->array = ecalloc(agenda->ntasks, sizeof(*agenda->array));
-	for (task = agenda->shead; task != NULL; task = task->snext) {
-		if (task->done) {
+	agenda->maxunblock = MIN(agenda->maxunblock, agenda->ntasks);
+	agenda->array = ecalloc(agenda->maxunblock + 1, sizeof(*agenda->array));
+	for (i = 0; i < agenda->norder; i++) {
+		id = agenda->order[i];
+		if (agenda->tasks[id].done) {
 			continue;
 		}
-		if (task->deps != NULL) {
-			cont = 0;
-			for (edge = task->deps; edge != NULL; edge = edge->next) {
-				if (!edge->to->done) {
-					cont = 1;
-					break;
-				}
-			}
-			if (cont) {
-				continue;
+		cont = 0;
+		for (j = agenda->depoff[id]; j < agenda->depoff[id + 1]; j++) {
+			if (!agenda->tasks[agenda->deps[j]].done) {
+				cont = 1;
+				break;
 			}
 		}
-		agenda->array[agenda->nunblock++] = task;
+		if (cont) {
+			continue;
+		}
+		addunblock(agenda, id);
 	}
 
 	/* fourth pass: sort array of unblocked tasks based on niceness */
-	qsort(agenda->array, agenda->nunblock, sizeof(*agenda->array), comparetask);
+	if (agenda->nunblock == agenda->maxunblock && agenda->maxunblock < agenda->ntasks)
+		sortheap(agenda->tasks, agenda->array, agenda->nunblock);
+	else
+		countsort(agenda);
+	return 0;
+}
+
+/* parse line into the agenda of build, remembering where the last line was copied to */
+static int
+snapline(void *p, const char *line, size_t len, char *filename)
+{
+	struct SnapBuild *build = p;
+
+	if (line < build->buf || line >= build->buf + build->size) {
+		build->last = line;
+		build->lastlen = len;
+	}
+	return parseline(build->agenda, line, len, filename);
+}
+
+/* get offset into the input file of s, which points into a line read by snapline() */
+static uint64_t
+snapoff(const struct SnapBuild *build, const char *s)
+{
+	/* a line not in the mapping is the copied last line, which ends the file */
+	if (s >= build->buf && s < build->buf + build->size)
+		return s - build->buf;
+	return build->size - build->lastlen + (s - build->last);
+}
+
+/* hash the tasks and the graphs of a snapshot */
+static uint64_t
+hashsnap(const struct SnapTask *tasks, size_t ntasks, size_t nedges, const uint32_t *depoff,
+         const uint32_t *deps, const uint32_t *rdepoff, const uint32_t *rdeps, const uint32_t *order)
+{
+	uint64_t key[2];
+
+	key[0] = siphash(tasks, ntasks * sizeof(*tasks), snapkey);
+	key[1] = siphash(order, ntasks * sizeof(*order), snapkey);
+	key[0] = siphash(depoff, (ntasks + 1) * sizeof(*depoff), key);
+	key[1] = siphash(deps, nedges * sizeof(*deps), key);
+	key[0] = siphash(rdepoff, (ntasks + 1) * sizeof(*rdepoff), key);
+	return siphash(rdeps, nedges * sizeof(*rdeps), key);
+}
+
+/* check whether the offsets and ids of graph of ntasks and nedges are in range */
+static int
+isvalidgraph(const uint32_t *off, const uint32_t *ids, size_t ntasks, size_t nedges)
+{
+	size_t i;
+
+	if (off[0] != 0 || off[ntasks] != nedges)
+		return 0;
+	for (i = 0; i < ntasks; i++)
+		if (off[i] > off[i + 1])
+			return 0;
+	for (i = 0; i < nedges; i++)
+		if (ids[i] >= ntasks)
+			return 0;
+	return 1;
+}
+
+/* copy n 32-bit ids from p into a new array */
+static uint32_t *
+copyids(const uint32_t *p, size_t n)
+{
+	uint32_t *ids;
+
+	ids = ecalloc(n + 1, sizeof(*ids));
+	memcpy(ids, p, n * sizeof(*ids));
+	return ids;
+}
+
+/* load tasks of file from the snapshot at path, if it matches hdr; return -1 if it is stale or corrupt */
+static int
+loadsnap(struct Agenda *agenda, const char *path, const struct SnapHeader *hdr, const char *buf, char *filename)
+{
+	const struct SnapHeader *h;
+	const struct SnapTask *st;
+	const uint32_t *depoff, *deps, *rdepoff, *rdeps, *order;
+	struct stat sb;
+	unsigned char *seen;
+	uint64_t ntasks, nedges;
+	size_t size, i;
+	void *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || (uintmax_t)sb.st_size < sizeof(*h) ||
+	    (uintmax_t)sb.st_size > SIZE_MAX ||
+	    (map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	size = sb.st_size;
+	h = map;
+	ntasks = h->ntasks;
+	nedges = h->nedges;
+	if (memcmp(h, hdr, offsetof(struct SnapHeader, ntasks)) != 0 ||
+	    ntasks >= UINT32_MAX - 1 || nedges >= UINT32_MAX - 1 ||
+	    size - sizeof(*h) != ntasks * sizeof(*st) + (3 * ntasks + 2 + 2 * nedges) * sizeof(*deps))
+		goto stale;
+	st = (const struct SnapTask *)(h + 1);
+	order = (const uint32_t *)(st + ntasks);
+	depoff = order + ntasks;
+	deps = depoff + ntasks + 1;
+	rdepoff = deps + nedges;
+	rdeps = rdepoff + ntasks + 1;
+
+	/* check everything before loading any task, for a corrupt snapshot to be ignored as a whole */
+	for (i = 0; i < ntasks; i++) {
+		if (st[i].nameoff > hdr->size || st[i].namelen > hdr->size - st[i].nameoff ||
+		    st[i].descoff > hdr->size || st[i].desclen > hdr->size - st[i].descoff ||
+		    st[i].dateoff > hdr->size || st[i].datelen > hdr->size - st[i].dateoff ||
+		    st[i].pri < -1 || st[i].pri > +1 || st[i].done > 1)
+			goto stale;
+	}
+	if (!isvalidgraph(depoff, deps, ntasks, nedges) || !isvalidgraph(rdepoff, rdeps, ntasks, nedges))
+		goto stale;
+	seen = ecalloc(ntasks + 1, 1);
+	for (i = 0; i < ntasks; i++) {
+		if (order[i] >= ntasks || seen[order[i]]) {
+			free(seen);
+			goto stale;
+		}
+		seen[order[i]] = 1;
+	}
+	free(seen);
+	if (h->datahash != hashsnap(st, ntasks, nedges, depoff, deps, rdepoff, rdeps, order))
+		goto stale;
+
+	agenda->ntasks = agenda->maxtasks = agenda->norder = ntasks;
+	agenda->nedges = nedges;
+	agenda->tasks = ecalloc(ntasks + 1, sizeof(*agenda->tasks));
+	agenda->texts = ecalloc(ntasks + 1, sizeof(*agenda->texts));
+	for (i = 0; i < ntasks; i++) {
+		agenda->tasks[i].nice = DEFNICE;
+		agenda->tasks[i].due = st[i].due;
+		agenda->tasks[i].pri = st[i].pri;
+		agenda->tasks[i].done = st[i].done;
+		agenda->tasks[i].visited = 2;
+		agenda->tasks[i].init = 1;
+		agenda->texts[i].name = buf + st[i].nameoff;
+		agenda->texts[i].namelen = st[i].namelen;
+		agenda->texts[i].filename = filename;
+		agenda->texts[i].desc = buf + st[i].descoff;
+		agenda->texts[i].desclen = st[i].desclen;
+		agenda->texts[i].date = (st[i].datelen > 0) ? buf + st[i].dateoff : NULL;
+		agenda->texts[i].datelen = st[i].datelen;
+		agenda->tasks[order[i]].pos = i;
+	}
+	agenda->order = copyids(order, ntasks);
+	agenda->depoff = copyids(depoff, ntasks + 1);
+	agenda->deps = copyids(deps, nedges);
+	agenda->rdepoff = copyids(rdepoff, ntasks + 1);
+	agenda->rdeps = copyids(rdeps, nedges);
+	munmap(map, size);
+	return 0;
+stale:
+	munmap(map, size);
+	return -1;
+}
+
+/* write the tasks read into the agenda of build into path, replacing it; the snapshot is optional, so errors are ignored */
+static void
+writesnap(const char *path, struct SnapHeader *hdr, struct SnapBuild *build)
+{
+	struct Agenda *agenda;
+	struct SnapTask *st;
+	struct Text *text;
+	char tmp[PATH_MAX];
+	size_t i;
+	int fd;
+
+	agenda = build->agenda;
+	st = ecalloc(agenda->ntasks + 1, sizeof(*st));
+	for (i = 0; i < agenda->ntasks; i++) {
+		text = &agenda->texts[i];
+		st[i].nameoff = snapoff(build, text->name);
+		st[i].namelen = text->namelen;
+		st[i].descoff = snapoff(build, text->desc);
+		st[i].desclen = text->desclen;
+		st[i].dateoff = (text->date != NULL) ? snapoff(build, text->date) : 0;
+		st[i].datelen = text->datelen;
+		st[i].due = agenda->tasks[i].due;
+		st[i].pri = agenda->tasks[i].pri;
+		st[i].done = agenda->tasks[i].done;
+	}
+	hdr->ntasks = agenda->ntasks;
+	hdr->nedges = agenda->nedges;
+	hdr->datahash = hashsnap(st, agenda->ntasks, agenda->nedges, agenda->depoff, agenda->deps,
+	                         agenda->rdepoff, agenda->rdeps, agenda->order);
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp) ||
+	    (fd = mkstemp(tmp)) == -1) {
+		free(st);
+		return;
+	}
+	if (writefile(fd, hdr, sizeof(*hdr)) == -1 ||
+	    writefile(fd, st, agenda->ntasks * sizeof(*st)) == -1 ||
+	    writefile(fd, agenda->order, agenda->ntasks * sizeof(*agenda->order)) == -1 ||
+	    writefile(fd, agenda->depoff, (agenda->ntasks + 1) * sizeof(*agenda->depoff)) == -1 ||
+	    writefile(fd, agenda->deps, agenda->nedges * sizeof(*agenda->deps)) == -1 ||
+	    writefile(fd, agenda->rdepoff, (agenda->ntasks + 1) * sizeof(*agenda->rdepoff)) == -1 ||
+	    writefile(fd, agenda->rdeps, agenda->nedges * sizeof(*agenda->rdeps)) == -1) {
+		close(fd);
+		unlink(tmp);
+		free(st);
+		return;
+	}
+	if (close(fd) == -1 || rename(tmp, path) == -1)
+		unlink(tmp);
+	free(st);
+}
+
+/* read tasks from file, going through its snapshot if there is a snapshot directory; return like readfile() */
+static int
+readtodo(struct Agenda *agenda, struct Input *in, char *filename)
+{
+	struct SnapBuild build;
+	struct SnapHeader hdr;
+	struct stat st;
+	const char *buf;
+	char path[PATH_MAX];
+	int fd, retval;
+
+	if (cachedir == NULL || strcmp(filename, "-") == 0)
+		return readfile(parseline, agenda, in, filename);
+	if ((fd = open(filename, O_RDONLY)) == -1)
+		return readfile(parseline, agenda, in, filename);
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (buf = mapinput(in, fd, &st)) == NULL) {
+		close(fd);
+		return readfile(parseline, agenda, in, filename);
+	}
+	close(fd);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPMAGIC, sizeof(hdr.magic));
+	hdr.dev = st.st_dev;
+	hdr.ino = st.st_ino;
+	hdr.size = st.st_size;
+	hdr.mtime = st.st_mtim.tv_sec;
+	hdr.mtimensec = st.st_mtim.tv_nsec;
+	hdr.hash = siphash(buf, st.st_size, snapkey);
+	if (cachepath(path, sizeof(path), cachedir, "todo", filename) == -1)
+		return maplines(parseline, agenda, in, buf, st.st_size, filename);
+	if (loadsnap(agenda, path, &hdr, buf, filename) == 0)
+		return 0;
+	memset(&build, 0, sizeof(build));
+	build.agenda = agenda;
+	build.buf = buf;
+	build.size = st.st_size;
+	retval = maplines(snapline, &build, in, buf, st.st_size, filename);
+	if (retval == 0 && agenda->nwarns == 0 && toposort(agenda) == 0)
+		writesnap(path, &hdr, &build);
+	else
+		(void)unlink(path);
+	return retval;
 }
 
-/* print sorted tasks */
+/* print task id of agenda */
 static void
-printtasks(struct Agenda *agenda, int lflag, int prefix)
+printtask(struct Agenda *agenda, uint32_t id, int lflag, int prefix)
 {
 	struct Task *task;
+	struct Text *text;
+
+	task = &agenda->tasks[id];
+	text = &agenda->texts[id];
+	if (lflag)
+		outstr(task->pri < 0 ? "(C) " : (task->pri > 0 ? "(A) " : "(B) "));
+	if (lflag && prefix) {
+		outstr(text->filename);
+		outbytes(": ", 2);
+	}
+	outbytes(text->desc, text->desclen);
+	if (lflag && text->date != NULL) {
+		outbytes(" due:", 5);
+		outbytes(text->date, text->datelen);
+	}
+	outbytes("\n", 1);
+}
+
+/* print sorted tasks, but the first offset ones */
+static void
+printtasks(struct Agenda *agenda, int lflag, int prefix, size_t offset)
+{
 	size_t i;
 
-	for (i = 0; i < agenda->nunblock; i++) {
-		task = agenda->array[i];
-		if (lflag)
-			printf("(%c) ", (task->pri < 0 ? 'C' : (task->pri > 0 ? 'A' : 'B')));
-		if (lflag && prefix)
-			printf("%s: ", task->filename);
-		printf("%s", task->desc);
-		if (lflag && task->date != NULL)
-			printf(" due:%s", task->date);
-		printf("\n");
+	for (i = offset; i < agenda->nunblock; i++)
+		printtask(agenda, agenda->array[i], lflag, prefix);
+	outflush();
+}
+
+/* read the tasks of part i on their own */
+static void
+parsepart(void *p, size_t i)
+{
+	struct Part *part;
+
+	part = (struct Part *)p + i;
+	if (strcmp(part->filename, "-") != 0) {
+		deferwarnings(&part->warnings);
+		part->retval = readtodo(&part->agenda, &part->input, part->filename);
+		deferwarnings(NULL);
+	}
+	free(part->agenda.htab);
+	free(part->agenda.props);
+	part->agenda.htab = NULL;
+	part->agenda.props = NULL;
+}
+
+/* sort the tasks of part i on their own */
+static void
+sortpart(void *p, size_t i)
+{
+	struct Part *part;
+
+	part = (struct Part *)p + i;
+	sorttasks(&part->agenda, part->today, part->dflag);
+}
+
+/* read files on up to njobs threads, each into its part */
+static int
+readparts(struct Part *parts, int nfiles, char *files[], int njobs, size_t maxunblock)
+{
+	int retval = 0;
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		parts[i].filename = files[i];
+		initagenda(&parts[i].agenda, maxunblock);
+	}
+
+	/* stdin cannot be read concurrently, so it is read here, in order */
+	for (i = 0; i < nfiles; i++) {
+		if (strcmp(files[i], "-") == 0) {
+			deferwarnings(&parts[i].warnings);
+			parts[i].retval = readfile(parseline, &parts[i].agenda, &parts[i].input, files[i]);
+			deferwarnings(NULL);
+		}
 	}
-	if (ferror(stdout)) {
-		err(1, "stdout");
+	runjobs(parsepart, parts, nfiles, njobs);
+
+	/* warnings are printed as if the files were read one after another */
+	for (i = 0; i < nfiles; i++) {
+		printwarnings(&parts[i].warnings);
+		if (parts[i].retval == -1)
+			retval = -1;
 	}
+	return retval;
 }
 
-/* free agenda and its tasks */
+/* sort the tasks of each part on up to njobs threads */
 static void
-freeagenda(struct Agenda *agenda)
+sortparts(struct Part *parts, int nparts, int today, int dflag, int njobs)
+{
+	int i;
+
+	for (i = 0; i < nparts; i++) {
+		parts[i].today = today;
+		parts[i].dflag = dflag;
+	}
+	runjobs(sortpart, parts, nparts, njobs);
+
+	/*
+	 * Tasks are visited from the last one read, so a single agenda
+	 * would have failed on the last file whose tasks cannot be sorted.
+	 */
+	for (i = nparts; i-- > 0; )
+		if (parts[i].agenda.error != NULL)
+			errx(1, "%s", parts[i].agenda.error);
+}
+
+/*
+ * Print the sorted tasks of the parts, but the first offset ones, in the
+ * order they would have if all files were read into a single agenda.
+ * Tasks in different files never depend on each other, and tasks are
+ * visited from the last one read; so the tasks of a file come before
+ * those of the files read before it in the topological order.  Thus,
+ * for each niceness, the tasks as nice as that are taken from the last
+ * part to the first one, in the order they are sorted in each part.
+ */
+static void
+printparts(struct Part *parts, int nparts, int lflag, int prefix, size_t offset, size_t max)
 {
-	struct Task *task, *ttmp;
-	struct Edge *edge, *etmp;
+	struct Agenda *agenda;
+	size_t *next;
+	size_t n;
+	int nice, i;
 
-	for (task = agenda->unsort; task != NULL; ) {
-		for (edge = task->deps; edge != NULL; ) {
-			etmp = edge;
-			edge = edge->next;
-			free(etmp);
+	next = ecalloc(nparts, sizeof(*next));
+	n = 0;
+	for (nice = MINNICE; nice <= MAXNICE && n < max; nice++) {
+		for (i = nparts - 1; i >= 0; i--) {
+			agenda = &parts[i].agenda;
+			for (; next[i] < agenda->nunblock && n < max; next[i]++, n++) {
+				if (agenda->tasks[agenda->array[next[i]]].nice != nice)
+					break;
+				if (n >= offset) {
+					printtask(agenda, agenda->array[next[i]], lflag, prefix);
+				}
+			}
 		}
-		ttmp = task;
-		task = task->unext;
-		free(ttmp->name);
-		free(ttmp->desc);
-		free(ttmp->date);
-		free(ttmp);
 	}
+	free(next);
+	outflush();
+}
+
+/* free agenda and its tasks */
+static void
+freeagenda(struct Agenda *agenda)
+{
+	free(agenda->tasks);
+	free(agenda->texts);
+	free(agenda->depoff);
+	free(agenda->deps);
+	free(agenda->rdepoff);
+	free(agenda->rdeps);
+	free(agenda->order);
 	free(agenda->array);
+	free(agenda->error);
 }
 
 /* todo: print next tasks */
 int
 main(int argc, char *argv[])
 {
-	static struct Agenda agenda = {
-		.array = NULL,
-		.unsort = NULL,
-		.shead = NULL,
-		.stail = NULL,
-		.nunblock = 0,
-		.ntasks = 0,
+	static struct Agenda agenda;
+	static struct Input input = {
+		.arena = { .blocks = NULL, .used = 0, .size = 0 },
+		.maps = NULL,
 	};
+	struct Part *parts = NULL;
 	struct Date d;
 	int exitval = 0;
 	static int dflag = 0;           /* whether to consider tasks with passed deadline as done */
 	static int lflag = 0;           /* whether to display tasks in long format */
+	size_t count = SIZE_MAX;        /* number of tasks to print */
+	size_t offset = 0;              /* number of most urgent tasks not to print */
+	size_t max = SIZE_MAX;          /* number of most urgent tasks to keep */
+	int njobs = 1;                  /* number of threads reading files */
+	int nstdin = 0;                 /* number of times stdin is given as file */
 	int today;                      /* today in UNIX julian day */
-	int ch;
+	int ch, i;
 
+	profile(NULL);
 	if (gettoday(&d) == -1)
 		err(1, NULL);
 	today = datetojulian(&d);
-	agenda.htab = ecalloc(NHASH, sizeof(*agenda.htab));
-	while ((ch = getopt(argc, argv, "dlT:")) != -1) {
+#ifdef _SC_NPROCESSORS_ONLN
+	if ((njobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		njobs = 1;
+#endif
+	while ((ch = getopt(argc, argv, "c:dj:ln:o:T:")) != -1) {
 		switch (ch) {
+		case 'c':
+			cachedir = optarg;
+			break;
 		case 'd':
 			dflag = 1;
 			break;
+		case 'j':
+			njobs = strtonum(optarg, 1, INT_MAX);
+			break;
 		case 'l':
 			lflag = 1;
 			break;
+		case 'n':
+			count = strtonum(optarg, 0, INT_MAX);
+			break;
+		case 'o':
+			offset = strtonum(optarg, 0, INT_MAX);
+			break;
 		case 'T':
 			if (strtodate(&d, optarg, NULL) == -1)
 				errx(1, "improper argument date: %s", optarg);
@@ -523,11 +1436,46 @@ main(int argc, char *argv[])
 	}
 	argc -= optind;
 	argv += optind;
-	if (readinput(parseline, &agenda, argc, argv) == -1)
-		exitval = 1;
-	free(agenda.htab);              /* we don't need the hash table anymore */
-	sorttasks(&agenda, today, dflag);
-	printtasks(&agenda, lflag, argc > 1);
+	if (count != SIZE_MAX)
+		max = offset + count;
+	for (i = 0; i < argc; i++)
+		if (strcmp(argv[i], "-") == 0)
+			nstdin++;
+
+	/*
+	 * Snapshots are kept per file, so files are read into parts if
+	 * there is a snapshot directory.  All tasks read from stdin have
+	 * the same filename, so if it is given more than once, its tasks
+	 * must go into a single agenda.
+	 */
+	if (((njobs > 1 && argc > 1) || (cachedir != NULL && argc > 0)) && nstdin < 2) {
+		parts = ecalloc(argc, sizeof(*parts));
+		if (readparts(parts, argc, argv, njobs, max) == -1)
+			exitval = 1;
+		profile("parse");
+		sortparts(parts, argc, today, dflag, njobs);
+		profile("sort");
+		printparts(parts, argc, lflag, argc > 1, offset, max);
+	} else {
+		initagenda(&agenda, max);
+		if (readinput(parseline, &agenda, &input, argc, argv) == -1)
+			exitval = 1;
+		free(agenda.htab);      /* we don't need the interning table anymore */
+		free(agenda.props);
+		profile("parse");
+		if (sorttasks(&agenda, today, dflag) == -1)
+			errx(1, "%s", agenda.error);
+		profile("sort");
+		printtasks(&agenda, lflag, argc > 1, offset);
+	}
+	profile("print");
 	freeagenda(&agenda);
+	freeinput(&input);
+	for (i = 0; parts != NULL && i < argc; i++) {
+		freeagenda(&parts[i].agenda);
+		freeinput(&parts[i].input);
+	}
+	free(parts);
+	profile("free");
 	return exitval;
 }
@@ -1,18 +1,78 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "util.h"
 
 #define DAYSPERWEEK 7
-#define MAX_DAYS      35
+#define EPOCHWDAY     THURSDAY          /* weekday of 1970-01-01 */
+#define EPOCHDAYS     719162            /* days from 0001-01-01 to 1970-01-01 */
 #define ISLEAP(y)     ((!((y) % 4) && ((y) % 100)) || !((y) % 400))
+#define ISDIGIT(c)    ((unsigned)((c) - '0') < 10)
+#define ARENABLOCK    (64 * 1024)       /* size of arena memory blocks */
+#define OUTBUFSIZE    (64 * 1024)       /* size of output buffer */
+#define ARENAALIGN    (sizeof(union Align))
+#define ROTL(x, b)    (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND(v0, v1, v2, v3) do { \
+	(v0) += (v1); (v1) = ROTL((v1), 13); (v1) ^= (v0); (v0) = ROTL((v0), 32); \
+	(v2) += (v3); (v3) = ROTL((v3), 16); (v3) ^= (v2); \
+	(v0) += (v3); (v3) = ROTL((v3), 21); (v3) ^= (v0); \
+	(v2) += (v1); (v1) = ROTL((v1), 17); (v1) ^= (v2); (v2) = ROTL((v2), 32); \
+} while (0)
+
+/* type with the strictest alignment requirement */
+union Align {
+	long double ld;
+	long long ll;
+	void *p;
+	void (*f)(void);
+};
+
+/* memory-mapped input file */
+struct Mapping {
+	struct Mapping *next;
+	void *addr;
+	size_t size;
+};
+
+/* jobs shared by a pool of threads */
+struct Pool {
+	pthread_mutex_t lock;           /* protects next */
+	void (*fun)(void *, size_t);    /* function running each job */
+	void *arg;                      /* argument passed to fun */
+	size_t next;                    /* next job to be taken */
+	size_t njobs;                   /* number of jobs */
+};
+
+/* memory block of an arena */
+struct ArenaBlock {
+	struct ArenaBlock *prev;        /* block allocated before this one */
+	union Align data[];             /* memory handed out by the arena */
+};
+
+/*
+ * Output to stdout is collected into a large buffer and written with
+ * write(2) when the buffer fills up, bypassing stdio's formatting and
+ * locking.  Nothing else writes to stdout.
+ */
+static char outbuf[OUTBUFSIZE];
+static size_t outlen = 0;
+
+static _Thread_local struct Warnings *deferred = NULL;  /* where warnings of the thread are kept, if not printed */
 
 /* table of day in month, indexed by whether year is leap and month number */
 static const int daytab[2][13] = {
@@ -20,44 +80,230 @@ static const int daytab[2][13] = {
 	{0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31},
 };
 
-/* read lines from fp */
+/* table of days in year before month, indexed by whether year is leap and month number */
+static const int yeartab[2][14] = {
+	{0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365},
+	{0, 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366},
+};
+
+/* table of week of month of day in month, counting from 1 */
+static const signed char weektab[32] = {
+	0, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5,
+};
+
+/* skip leading blanks of line; return 0 if nothing is left or it is a comment */
 static int
-getlines(Parser fun, void *p, FILE *fp, char *filename)
+trimline(const char **line, size_t *len)
+{
+	while (*len > 0 && isspace(*(unsigned char *)*line)) {
+		(*line)++;
+		(*len)--;
+	}
+	return *len > 0 && **line != '#';
+}
+
+/* keep or print warning from fmt and ap, followed by the string of error errnum if it is not 0 */
+static void
+vwarning(int errnum, const char *fmt, va_list ap)
+{
+	va_list aq;
+	size_t len;
+	int n;
+
+	if (deferred == NULL) {
+		/* files may be read by several threads at once, so stderr is locked for warnings not to get mixed up */
+		flockfile(stderr);
+		errno = errnum;
+		if (errnum != 0)
+			vwarn(fmt, ap);
+		else
+			vwarnx(fmt, ap);
+		funlockfile(stderr);
+		return;
+	}
+	va_copy(aq, ap);
+	if ((n = vsnprintf(NULL, 0, fmt, aq)) < 0)
+		err(1, "vsnprintf");
+	va_end(aq);
+	len = n + 1;
+	if (errnum != 0)
+		len += 2 + strlen(strerror(errnum));
+	while (deferred->len + len > deferred->size) {
+		deferred->size = (deferred->size == 0) ? 128 : 2 * deferred->size;
+		deferred->buf = ereallocarray(deferred->buf, deferred->size, 1);
+	}
+	(void)vsnprintf(deferred->buf + deferred->len, n + 1, fmt, ap);
+	if (errnum != 0)
+		(void)snprintf(deferred->buf + deferred->len + n, len - n, ": %s", strerror(errnum));
+	deferred->len += len;
+}
+
+/* warn with message from fmt, as warnx(3) does; but keep it if warnings of the thread are deferred */
+void
+warnmsg(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vwarning(0, fmt, ap);
+	va_end(ap);
+}
+
+/* warn with message from fmt and the string of errno, as warn(3) does; but keep it if warnings of the thread are deferred */
+void
+warnerr(const char *fmt, ...)
+{
+	va_list ap;
+	int errnum;
+
+	errnum = errno;
+	va_start(ap, fmt);
+	vwarning(errnum, fmt, ap);
+	va_end(ap);
+}
+
+/* keep the warnings of the calling thread into w from now on; or print them again, if w is NULL */
+void
+deferwarnings(struct Warnings *w)
+{
+	deferred = w;
+}
+
+/* print the warnings kept into w, and free them */
+void
+printwarnings(struct Warnings *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->len; i += strlen(w->buf + i) + 1)
+		warnx("%s", w->buf + i);
+	free(w->buf);
+	w->buf = NULL;
+	w->len = w->size = 0;
+}
+
+/* call parser on line; warn and return -1 if it is invalid */
+static int
+callparser(Parser fun, void *p, const char *line, size_t len, char *filename, size_t linenum)
+{
+	if ((*fun)(p, line, len, filename) == -1) {
+		warnmsg("%s:%zu: invalid line", filename, linenum);
+		return -1;
+	}
+	return 0;
+}
+
+/* read lines from fp, copying them into the arena of in; or not keeping them, if in is NULL */
+static int
+getlines(Parser fun, void *p, struct Input *in, FILE *fp, char *filename)
 {
 	ssize_t linelen = 0;
 	size_t linesize = 0;
 	size_t linenum = 0;
+	size_t len;
 	int retval = 0;
 	char *line = NULL;
-	char *s;
+	const char *s;
 
 	while ((linelen = getline(&line, &linesize, fp)) != -1) {
 		linenum++;
-		if (linelen > 0 && line[linelen - 1] == '\n')
-			line[linelen - 1] = '\0';
-		for (s = line; isspace(*s); s++)
-			;
-		if (*s == '#' || *s == '\0')
+		len = linelen;
+		if (len > 0 && line[len - 1] == '\n')
+			len--;
+		s = line;
+		if (!trimline(&s, &len))
 			continue;
-		if ((*fun)(p, s, filename) == -1) {
-			warnx("%s:%zu: invalid line", filename, linenum);
+		if (in != NULL)
+			s = arenastrndup(&in->arena, s, len);
+		if (callparser(fun, p, s, len, filename, linenum) == -1) {
 			retval = -1;
 		}
 	}
 	free(line);
 	if (ferror(fp)) {
-		warn(NULL);
+		warnerr("%s", filename);
 		clearerr(fp);
 		return -1;
 	}
 	return retval;
 }
 
-/* get week of year */
+/* read lines from the memory-mapped file of size bytes at buf */
+int
+maplines(Parser fun, void *p, struct Input *in, const char *buf, size_t size, char *filename)
+{
+	const char *end, *eol, *s;
+	size_t linenum = 0;
+	size_t len;
+	int retval = 0;
+
+	for (end = buf + size; buf < end; buf = eol + 1) {
+		linenum++;
+		if ((eol = memchr(buf, '\n', end - buf)) == NULL)
+			eol = end;
+		s = buf;
+		len = eol - buf;
+		if (!trimline(&s, &len))
+			continue;
+		if (eol == end) {
+			/* the last line is not followed by a newline to stop at */
+			s = arenastrndup(&in->arena, s, len);
+		}
+		if (callparser(fun, p, s, len, filename, linenum) == -1) {
+			retval = -1;
+		}
+	}
+	return retval;
+}
+
+/* memory-map the regular file fd, whose status is st, into in; return NULL on error */
+const char *
+mapinput(struct Input *in, int fd, const struct stat *st)
+{
+	struct Mapping *map;
+	void *buf;
+
+	if (st->st_size == 0 || (uintmax_t)st->st_size > SIZE_MAX)
+		return NULL;
+	if ((buf = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+		return NULL;
+	map = arenaalloc(&in->arena, sizeof(*map));
+	map->addr = buf;
+	map->size = st->st_size;
+	map->next = in->maps;
+	in->maps = map;
+	return buf;
+}
+
+/* read lines from fp, memory-mapping it if it is a regular file */
 static int
-getweeknum(int day, int wday)
+readfp(Parser fun, void *p, struct Input *in, FILE *fp, char *filename)
+{
+	struct stat st;
+	const char *buf;
+
+	if (fstat(fileno(fp), &st) == -1) {
+		warnerr("%s", filename);
+		return -1;
+	}
+	/* a file read from the middle (as stdin can be) is not mapped */
+	if (!S_ISREG(st.st_mode) || lseek(fileno(fp), 0, SEEK_CUR) != 0)
+		return getlines(fun, p, in, fp, filename);
+	if (st.st_size == 0)
+		return 0;
+	if ((buf = mapinput(in, fileno(fp), &st)) == NULL)
+		return getlines(fun, p, in, fp, filename);
+	(void)lseek(fileno(fp), 0, SEEK_END);
+	return maplines(fun, p, in, buf, st.st_size, filename);
+}
+
+/* set the weeks of the month of date, counting from its beginning and from its end */
+static void
+setmonthweek(struct Date *d)
 {
-	return 1 + (day + DAYSPERWEEK - wday) / DAYSPERWEEK;
+	d->pmw = weektab[d->d];
+	d->nmw = -weektab[daytab[ISLEAP(d->y)][d->m] - d->d + 1];
 }
 
 /* struct tm to struct Date */
@@ -68,25 +314,73 @@ tmtodate(struct tm *tm, struct Date *d)
 	d->m = tm->tm_mon + 1;
 	d->d = tm->tm_mday;
 	d->w = tm->tm_wday;
-	d->pmw = getweeknum(d->d, d->w);
-	d->nmw = -1 -(getweeknum(daytab[ISLEAP(d->y)][d->m] + 1, d->w - d->d + daytab[ISLEAP(d->y)][d->m] + 1 + MAX_DAYS) - d->pmw);
+	setmonthweek(d);
 }
 
-/* convert struct tm to unix julian day (days since unix epoch) */
+/* convert struct Date to unix julian day (days since unix epoch) */
 int
 datetojulian(struct Date *d)
 {
-	int y, m;
+	int y;
 
 	if (d->y < 1 || d->m < 1 || d->m > 12 || d->d < 1 || d->d > daytab[ISLEAP(d->y)][d->m])
 		return -1;
-	y = d->y;
-	m = d->m;
-	if (m < 3) {
-		y--;
-		m += 12;
-	}
-	return (y * 365) + (y / 4) - (y / 100) + (y / 400) - 719468 + (m * 153 + 3) / 5 - 92 + d->d - 1;
+	y = d->y - 1;
+	return (y * 365) + (y / 4) - (y / 100) + (y / 400) + yeartab[ISLEAP(d->y)][d->m] + d->d - 1 - EPOCHDAYS;
+}
+
+/* convert unix julian day (days since unix epoch) to struct Date */
+void
+juliantodate(struct Date *d, int j)
+{
+	int z, era, doe, yoe, doy, m;
+	const int *days;
+
+	/*
+	 * Count 400-year eras from 0001-01-01.  The years of an era are
+	 * like its centuries, and those like their 4-year spans: all of
+	 * the same length but the last one, which has one day more (or,
+	 * for centuries, one less); so the year of the era comes from
+	 * the day of the era without a loop.  The month of the day of
+	 * the year is then at most one past a guess.
+	 */
+	z = j + EPOCHDAYS;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	d->y = era * 400 + yoe + 1;
+	days = yeartab[ISLEAP(d->y)];
+	m = doy / 32 + 1;
+	if (doy >= days[m + 1])
+		m++;
+	d->m = m;
+	d->d = doy - days[m] + 1;
+	d->w = ((j + EPOCHWDAY) % DAYSPERWEEK + DAYSPERWEEK) % DAYSPERWEEK;
+	setmonthweek(d);
+}
+
+/* get number of days in month of year */
+int
+daysinmonth(int y, int m)
+{
+	return daytab[ISLEAP(y)][m];
+}
+
+/* fill date for day of month of year; return -1 if there is no such day */
+int
+mkdate(struct Date *d, int y, int m, int day)
+{
+	int j;
+
+	d->y = y;
+	d->m = m;
+	d->d = day;
+	if ((j = datetojulian(d)) == -1)
+		return -1;
+	d->w = ((j + EPOCHWDAY) % DAYSPERWEEK + DAYSPERWEEK) % DAYSPERWEEK;
+	setmonthweek(d);
+	return 0;
 }
 
 /* call malloc checking for error */
@@ -111,6 +405,150 @@ ecalloc(size_t nmemb, size_t size)
 	return p;
 }
 
+/* call realloc for an array checking for overflow and error */
+void *
+ereallocarray(void *p, size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		err(1, "realloc");
+	}
+	if ((p = realloc(p, nmemb * size)) == NULL)
+		err(1, "realloc");
+	return p;
+}
+
+/* get size bytes aligned to align from arena, allocating a new block if the current one is full */
+static void *
+arenabump(struct Arena *arena, size_t size, size_t align)
+{
+	struct ArenaBlock *block;
+	size_t bsize, off;
+	void *p;
+
+	off = (arena->used + align - 1) / align * align;
+	if (arena->blocks == NULL || off > arena->size || arena->size - off < size) {
+		bsize = (size > ARENABLOCK) ? size : ARENABLOCK;
+		block = emalloc(offsetof(struct ArenaBlock, data) + bsize);
+		block->prev = arena->blocks;
+		arena->blocks = block;
+		arena->size = bsize;
+		off = 0;
+	}
+	p = (char *)arena->blocks->data + off;
+	arena->used = off + size;
+	return p;
+}
+
+/* get memory for an object of size bytes from arena */
+void *
+arenaalloc(struct Arena *arena, size_t size)
+{
+	return arenabump(arena, size, ARENAALIGN);
+}
+
+/* copy the n bytes at s into arena, as a nul-terminated string */
+char *
+arenastrndup(struct Arena *arena, const char *s, size_t n)
+{
+	char *t;
+
+	t = memcpy(arenabump(arena, n + 1, 1), s, n);
+	t[n] = '\0';
+	return t;
+}
+
+/* release all memory of arena */
+void
+arenafree(struct Arena *arena)
+{
+	struct ArenaBlock *block;
+
+	while ((block = arena->blocks) != NULL) {
+		arena->blocks = block->prev;
+		free(block);
+	}
+	arena->used = arena->size = 0;
+}
+
+/*
+ * SipHash-1-3 of the n bytes at p, keyed with key.  Unlike simpler
+ * hashes, its values cannot be predicted without knowing the key.
+ */
+uint64_t
+siphash(const void *p, size_t n, const uint64_t key[2])
+{
+	const unsigned char *s = p;
+	uint64_t v0, v1, v2, v3, m;
+	size_t i;
+
+	v0 = key[0] ^ 0x736f6d6570736575ULL;
+	v1 = key[1] ^ 0x646f72616e646f6dULL;
+	v2 = key[0] ^ 0x6c7967656e657261ULL;
+	v3 = key[1] ^ 0x7465646279746573ULL;
+	for (; n >= 8; s += 8, n -= 8) {
+		m = 0;
+		for (i = 0; i < 8; i++)
+			m |= (uint64_t)s[i] << (8 * i);
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	m = (uint64_t)(s - (const unsigned char *)p + n) << 56;
+	for (i = 0; i < n; i++)
+		m |= (uint64_t)s[i] << (8 * i);
+	v3 ^= m;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= m;
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* write the n bytes at p into fd, handling short writes; return -1 on error */
+int
+writefile(int fd, const void *p, size_t n)
+{
+	const char *s = p;
+	ssize_t w;
+
+	while (n > 0) {
+		if ((w = write(fd, s, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		s += w;
+		n -= w;
+	}
+	return 0;
+}
+
+/*
+ * Get into path, of the given size, the name of the file of cache
+ * directory dir for the file filename, made of prefix and the hash
+ * of its real path; return -1 on error.  Files are not named after
+ * their inode, which changes when an editor saves a file through a
+ * rename, and would leave the old cache file behind on every save.
+ */
+int
+cachepath(char *path, size_t size, const char *dir, const char *prefix, const char *filename)
+{
+	static const uint64_t key[2] = { 0x7265616c70617468ULL, 0 };
+	char *real;
+	uint64_t h;
+	int n;
+
+	if ((real = realpath(filename, NULL)) == NULL)
+		return -1;
+	h = siphash(real, strlen(real), key);
+	free(real);
+	n = snprintf(path, size, "%s/%s.%016jx", dir, prefix, (uintmax_t)h);
+	return (n < 0 || (size_t)n >= size) ? -1 : 0;
+}
+
 /* call strdup checking for error */
 char *
 estrdup(const char *s)
@@ -122,52 +560,90 @@ estrdup(const char *s)
 	return t;
 }
 
-/* date string in YYYY-MM-DD format to date structure */
+/* read number of up to n digits from *s, not going past end; return -1 if there is no digit */
+static int
+getdigits(const char **s, const char *end, int n)
+{
+	const char *p;
+	int val;
+
+	val = 0;
+	for (p = *s; p < end && p < *s + n && isdigit((unsigned char)*p); p++)
+		val = val * 10 + *p - '0';
+	if (p == *s)
+		return -1;
+	*s = p;
+	return val;
+}
+
+/* date string of length len in YYYY-MM-DD format to unix julian day *j; return -1 on error */
+int
+strtojulian(int *j, const char *s, size_t len)
+{
+	struct Date d;
+	const char *end;
+	int y, leap;
+
+	/* the usual zero-padded form is read without looping */
+	if (len == 10 && s[4] == '-' && s[7] == '-' &&
+	    ISDIGIT(s[0]) && ISDIGIT(s[1]) && ISDIGIT(s[2]) && ISDIGIT(s[3]) &&
+	    ISDIGIT(s[5]) && ISDIGIT(s[6]) && ISDIGIT(s[8]) && ISDIGIT(s[9])) {
+		d.y = (s[0] - '0') * 1000 + (s[1] - '0') * 100 + (s[2] - '0') * 10 + (s[3] - '0');
+		d.m = (s[5] - '0') * 10 + (s[6] - '0');
+		d.d = (s[8] - '0') * 10 + (s[9] - '0');
+	} else {
+		end = s + len;
+		if ((d.y = getdigits(&s, end, 4)) == -1 || s == end || *s++ != '-')
+			return -1;
+		if ((d.m = getdigits(&s, end, 2)) == -1 || s == end || *s++ != '-')
+			return -1;
+		if ((d.d = getdigits(&s, end, 2)) == -1 || s != end)
+			return -1;
+	}
+	leap = ISLEAP(d.y);
+	if (d.y < 1 || d.m < 1 || d.m > 12 || d.d < 1 || d.d > daytab[leap][d.m])
+		return -1;
+	y = d.y - 1;
+	*j = (y * 365) + (y / 4) - (y / 100) + (y / 400) + yeartab[leap][d.m] + d.d - 1 - EPOCHDAYS;
+	return 0;
+}
+
+/* date string in [[YYYY-]MM-]DD format to date structure, the missing fields being today's */
 int
 strtodate(struct Date *d, const char *s, const char **endptr)
 {
-	struct tm *tmorig;
-	struct tm tm;
-	time_t t;
-	int format;
-	const char *ep;
+	struct Date today;
+	const char *ep, *end;
+	int nfields;
 
-	format = 1;
+	/* count the dash-separated fields, so we know which ones are missing */
 	ep = s;
-	while (isdigit(*ep))
-		ep++;
-	if (*ep == '-') {
-		format++;
-		while (isdigit(*ep))
+	for (nfields = 1; ; nfields++) {
+		while (isdigit((unsigned char)*ep))
 			ep++;
-		if (*ep == '-') {
-			format++;
-		}
+		if (nfields == 3 || *ep != '-')
+			break;
+		ep++;
 	}
-	switch (format) {
-	if ((t = time(NULL)) == -1)
-		err(1, NULL);
-	if ((tmorig = localtime(&t)) == NULL)
-		err(1, NULL);
-	tm = *tmorig;
-	case 3:
-		ep = strptime(s, "%Y-%m-%d", &tm);
-		break;
-	case 2:
-		ep = strptime(s, "%m-%d", &tm);
-		break;
-	default:
-		ep = strptime(s, "%d", &tm);
-		break;
+	end = ep;
+	if (nfields < 3 && gettoday(&today) == -1)
+		return -1;
+	if (nfields == 3) {
+		if ((today.y = getdigits(&s, end, 4)) == -1 || *s++ != '-')
+			return -1;
 	}
-	if (s[0] == '\0' || ep == NULL)
-		goto error;
+	if (nfields >= 2) {
+		if ((today.m = getdigits(&s, end, 2)) == -1 || *s++ != '-')
+			return -1;
+	}
+	if ((today.d = getdigits(&s, end, 2)) == -1)
+		return -1;
+	if (today.y < 1 || today.m < 1 || today.m > 12 || today.d < 1 || today.d > daysinmonth(today.y, today.m))
+		return -1;
 	if (endptr)
-		*endptr = ep;
-	tmtodate(&tm, d);
+		*endptr = s;
+	juliantodate(d, datetojulian(&today));
 	return 0;
-error:
-	return -1;
 }
 
 /* get time for today, at 12:00 */
@@ -185,67 +661,250 @@ gettoday(struct Date *d)
 	return 0;
 }
 
-/* read input from files or stdin; return -1 on error */
+/*
+ * Note that phase name of the program has ended, for benchmarking.
+ * If the environment variable ORGUTILS_PROFILE names a file, the
+ * time elapsed since the previous phase (or since the first call,
+ * with name NULL) is appended to it, as a tab-separated line.
+ */
+void
+profile(const char *name)
+{
+	static FILE *fp = NULL;
+	static struct timespec last;
+	struct timespec now;
+	char *path;
+
+	if (name == NULL) {
+		if ((path = getenv("ORGUTILS_PROFILE")) == NULL || *path == '\0')
+			return;
+		if ((fp = fopen(path, "a")) == NULL)
+			err(1, "%s", path);
+		clock_gettime(CLOCK_MONOTONIC, &last);
+		return;
+	}
+	if (fp == NULL)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(fp, "%s\t%.6f\n", name, (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9);
+	fflush(fp);
+	last = now;
+}
+
+/* write iov to stdout, handling short writes; exit on error */
+static void
+writeiov(struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		if ((n = writev(STDOUT_FILENO, iov, iovcnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "stdout");
+		}
+		for (; iovcnt > 0 && (size_t)n >= iov->iov_len; iov++, iovcnt--)
+			n -= iov->iov_len;
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+/* write buffered output to stdout */
+void
+outflush(void)
+{
+	struct iovec iov;
+
+	iov.iov_base = outbuf;
+	iov.iov_len = outlen;
+	writeiov(&iov, 1);
+	outlen = 0;
+}
+
+/* buffer n bytes from s for output; strings larger than the buffer are written directly */
+void
+outbytes(const char *s, size_t n)
+{
+	struct iovec iov[2];
+
+	if (n <= sizeof(outbuf) - outlen) {
+		memcpy(outbuf + outlen, s, n);
+		outlen += n;
+		return;
+	}
+	if (n < sizeof(outbuf)) {
+		outflush();
+		memcpy(outbuf, s, n);
+		outlen = n;
+		return;
+	}
+	iov[0].iov_base = outbuf;
+	iov[0].iov_len = outlen;
+	iov[1].iov_base = (char *)s;
+	iov[1].iov_len = n;
+	writeiov(iov, 2);
+	outlen = 0;
+}
+
+/* buffer string for output */
+void
+outstr(const char *s)
+{
+	outbytes(s, strlen(s));
+}
+
+/* read input from file, or from stdin if it is "-"; return -1 on error */
+int
+readfile(Parser fun, void *p, struct Input *in, char *filename)
+{
+	FILE *fp;
+	int retval;
+
+	if (strcmp(filename, "-") == 0)
+		return readfp(fun, p, in, stdin, "stdin");
+	if ((fp = fopen(filename, "r")) == NULL) {
+		warnerr("%s", filename);
+		return 1;
+	}
+	retval = readfp(fun, p, in, fp, filename);
+	fclose(fp);
+	return retval;
+}
+
+/*
+ * Read input from file, or from stdin if it is "-", like readfile();
+ * but each line is only kept until the parser returns, so the parser
+ * must copy whatever it keeps of it.
+ */
 int
-readinput(Parser fun, void *p, int argc, char *argv[])
+streamfile(Parser fun, void *p, char *filename)
 {
 	FILE *fp;
+	int retval;
+
+	if (strcmp(filename, "-") == 0)
+		return getlines(fun, p, NULL, stdin, "stdin");
+	if ((fp = fopen(filename, "r")) == NULL) {
+		warnerr("%s", filename);
+		return 1;
+	}
+	retval = getlines(fun, p, NULL, fp, filename);
+	fclose(fp);
+	return retval;
+}
+
+/* read input from files or stdin; return -1 on error */
+int
+readinput(Parser fun, void *p, struct Input *in, int argc, char *argv[])
+{
 	int retval = 0;
 
 	if (argc == 0) {
-		if (getlines(fun, p, stdin, "stdin") == -1) {
+		if (readfp(fun, p, in, stdin, "stdin") == -1) {
 			retval = -1;
 		}
 	}
 	for (; *argv != NULL; argv++) {
-		if (strcmp(*argv, "-") == 0) {
-			if (getlines(fun, p, stdin, "stdin") == -1) {
-				retval = -1;
-			}
-			continue;
-		}
-		if ((fp = fopen(*argv, "r")) == NULL) {
-			warn("%s", *argv);
-			retval = 1;
-			continue;
-		}
-		if (getlines(fun, p, fp, *argv) == -1) {
+		switch (readfile(fun, p, in, *argv)) {
+		case -1:
 			retval = -1;
+			break;
+		case 1:
+			retval = 1;
+			break;
 		}
-		fclose(fp);
 	}
 	return retval;
 }
 
+/* unmap input files and free lines read from streams */
+void
+freeinput(struct Input *in)
+{
+	struct Mapping *map;
+
+	for (map = in->maps; map != NULL; map = map->next)
+		munmap(map->addr, map->size);
+	in->maps = NULL;
+	arenafree(&in->arena);
+}
+
+/* take jobs from pool until there are none left */
+static void *
+worker(void *p)
+{
+	struct Pool *pool = p;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next;
+		if (pool->next < pool->njobs)
+			pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i == pool->njobs)
+			return NULL;
+		(*pool->fun)(pool->arg, i);
+	}
+}
+
+/* call fun(arg, i) for each i from 0 to njobs - 1, on up to nthreads threads */
+void
+runjobs(void (*fun)(void *, size_t), void *arg, size_t njobs, int nthreads)
+{
+	struct Pool pool;
+	pthread_t *tids;
+	size_t i, n;
+
+	n = (nthreads > 1) ? (size_t)nthreads : 1;
+	if (n > njobs)
+		n = njobs;
+	if (n <= 1) {
+		for (i = 0; i < njobs; i++)
+			(*fun)(arg, i);
+		return;
+	}
+	pool.fun = fun;
+	pool.arg = arg;
+	pool.next = 0;
+	pool.njobs = njobs;
+	if ((errno = pthread_mutex_init(&pool.lock, NULL)) != 0)
+		err(1, "pthread_mutex_init");
+	tids = ecalloc(n - 1, sizeof(*tids));
+
+	/* the calling thread is a worker too; we go on with fewer threads if we cannot create them */
+	for (i = 0; i < n - 1; i++)
+		if (pthread_create(&tids[i], NULL, worker, &pool) != 0)
+			break;
+	n = i;
+	(void)worker(&pool);
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&pool.lock);
+	free(tids);
+}
+
 /* increment date */
 void
 incrdate(struct Date *d)
 {
-	int n;
-
 	if (d->y < 1 || d->m < 1 || d->m > 12 || d->d < 1 || d->d > daytab[ISLEAP(d->y)][d->m])
 		return;
 	d->w = (d->w + 1) % DAYSPERWEEK;
-	if (d->w == 0) {
-		d->pmw++;
-		d->nmw++;
-	}
 	if (d->d < daytab[ISLEAP(d->y)][d->m]) {
 		d->d++;
 	} else if (d->m < 12) {
 		d->m++;
 		d->d = 1;
-		d->pmw = 1;
-		d->nmw = -1 -(getweeknum(daytab[ISLEAP(d->y)][d->m] + 1, d->w - d->d + daytab[ISLEAP(d->y)][d->m] + 1 + MAX_DAYS) - d->pmw);
 	} else {
-		printf("ASDA\n");
 		d->y++;
 		d->m = 1;
 		d->d = 1;
-		d->pmw = 1;
-		d->nmw = -1 -(getweeknum(daytab[ISLEAP(d->y)][d->m] + 1, d->w - d->d + daytab[ISLEAP(d->y)][d->m] + 1 + MAX_DAYS) - d->pmw);
 	}
-	n = daytab[ISLEAP(d->y)][d->m];
+	setmonthweek(d);
 }
 
 /* convert string value to int between min and max; exit on error */
@@ -8,6 +8,40 @@ struct Date {
 	int nmw;                /* negative week of the month */
 };
 
+/* bump allocator, whose memory is all released at once */
+struct Arena {
+	struct ArenaBlock *blocks;      /* list of memory blocks, most recent first */
+	size_t used;                    /* bytes used in the most recent block */
+	size_t size;                    /* size of the most recent block */
+};
+
+/* memory holding the lines passed to a Parser */
+struct Input {
+	/*
+	 * Regular files are memory-mapped, and their lines are passed
+	 * to the parser where they lie in the mapping; other files are
+	 * read line by line and each line is copied into the arena.
+	 * Either way, a line is followed by a newline or a nul byte,
+	 * and is kept in memory until the input is freed, so parsers
+	 * can keep pointers into it rather than copying strings out.
+	 */
+	struct Arena arena;             /* lines not kept in a mapping */
+	struct Mapping *maps;           /* list of memory-mapped files */
+};
+
+/* warnings of a thread, kept to be printed later */
+struct Warnings {
+	/*
+	 * Files read on several threads at once (see runjobs()) would
+	 * have their warnings printed in whatever order the threads get
+	 * to them.  So each thread keeps its warnings here, and they are
+	 * printed after the threads are joined, in the order of the files.
+	 */
+	char *buf;                      /* messages, each ended by a nul byte */
+	size_t len;                     /* bytes used in buf */
+	size_t size;                    /* allocated size of buf */
+};
+
 enum {
 	SUNDAY    = 0,
 	MONDAY    = 1,
@@ -18,14 +52,39 @@ enum {
 	SATURDAY  = 6,
 };
 
-typedef int (*Parser)(void *, char *, char *);
+typedef int (*Parser)(void *, const char *, size_t, char *);
 
 void *emalloc(size_t size);
 void *ecalloc(size_t nmemb, size_t size);
+void *ereallocarray(void *p, size_t nmemb, size_t size);
+void *arenaalloc(struct Arena *arena, size_t size);
+char *arenastrndup(struct Arena *arena, const char *s, size_t n);
+void arenafree(struct Arena *arena);
+void outbytes(const char *s, size_t n);
+void outstr(const char *s);
+void outflush(void);
+void profile(const char *name);
+void warnmsg(const char *fmt, ...);
+void warnerr(const char *fmt, ...);
+void deferwarnings(struct Warnings *w);
+void printwarnings(struct Warnings *w);
 void incrdate(struct Date *d);
 int gettoday(struct Date *);
 int datetojulian(struct Date *d);
-int readinput(Parser fun, void *p, int argc, char *argv[]);
+int mkdate(struct Date *d, int y, int m, int day);
+int daysinmonth(int y, int m);
+void juliantodate(struct Date *d, int j);
+const char *mapinput(struct Input *in, int fd, const struct stat *st);
+int maplines(Parser fun, void *p, struct Input *in, const char *buf, size_t size, char *filename);
+int readfile(Parser fun, void *p, struct Input *in, char *filename);
+int readinput(Parser fun, void *p, struct Input *in, int argc, char *argv[]);
+int streamfile(Parser fun, void *p, char *filename);
+void freeinput(struct Input *in);
+void runjobs(void (*fun)(void *, size_t), void *arg, size_t njobs, int nthreads);
 int strtodate(struct Date *d, const char *s, const char **endptr);
+int strtojulian(int *j, const char *s, size_t len);
 int strtonum(const char *s, int min, int max);
 char *estrdup(const char *s);
+uint64_t siphash(const void *p, size_t n, const uint64_t key[2]);
+int writefile(int fd, const void *p, size_t n);
+int cachepath(char *path, size_t size, const char *dir, const char *prefix, const char *filename);